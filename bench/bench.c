@@ -0,0 +1,294 @@
+/*
+ * bench.c - micro and end-to-end benchmarks for the shell's hot paths
+ *
+ * Usage: bench/bench [filter]
+ *
+ * Every benchmark runs a fixed number of samples; a sample times a batch of operations
+ * and yields one per-operation latency. Results are printed one JSON object per line:
+ *
+ *   {"bench":"eval_arith","ops":..,"ops_per_sec":..,"p50_ns":..,"p90_ns":..,"p99_ns":..}
+ *
+ * In-process benchmarks link the shell's modules directly. Script, fork/exec and
+ * pipeline benchmarks run the built ./ash (or $ASH) on a generated script and divide
+ * the wall time by the number of operations the script performs.
+ */
+#define _GNU_SOURCE
+#include <fcntl.h>
+#include <spawn.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "alias.h"
+#include "arith.h"
+#include "globbing.h"
+#include "history.h"
+#include "parser.h"
+#include "tokenizer.h"
+#include "vars.h"
+
+extern char **environ;
+
+#define SAMPLES 50
+#define WARMUP 3
+
+typedef struct {
+  const char *name;
+  void (*run)(void);  // one operation
+  int batch;          // operations per sample
+} bench_t;
+
+static double now_ns(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+static int cmp_double(const void *a, const void *b) {
+  double x = *(const double *)a, y = *(const double *)b;
+  return (x > y) - (x < y);
+}
+
+static double percentile(const double *sorted, int n, double p) {
+  int idx = (int)(p * (n - 1) + 0.5);
+  return sorted[idx];
+}
+
+/* Print one result line from per-operation latencies (sorts samples) */
+static void report(const char *name, double *samples, int n, long ops, double total_ns) {
+  qsort(samples, n, sizeof(double), cmp_double);
+  printf("{\"bench\":\"%s\",\"ops\":%ld,\"ops_per_sec\":%.1f,\"p50_ns\":%.1f,"
+         "\"p90_ns\":%.1f,\"p99_ns\":%.1f}\n",
+         name, ops, ops / (total_ns / 1e9), percentile(samples, n, 0.50),
+         percentile(samples, n, 0.90), percentile(samples, n, 0.99));
+  fflush(stdout);
+}
+
+static void run_bench(const bench_t *b) {
+  double samples[SAMPLES];
+  double total = 0;
+  for (int s = 0; s < WARMUP + SAMPLES; s++) {
+    double start = now_ns();
+    for (int i = 0; i < b->batch; i++) b->run();
+    double elapsed = now_ns() - start;
+    if (s < WARMUP) continue;
+    samples[s - WARMUP] = elapsed / b->batch;
+    total += elapsed;
+  }
+  report(b->name, samples, SAMPLES, (long)SAMPLES * b->batch, total);
+}
+
+// ---------------- In-process benchmarks ----------------
+
+static void bench_split(void) {
+  int argc;
+  char **argv =
+      split_command_line("grep -n \"hello world\" 'file name.txt' a\\ b --color=auto | wc -l",
+                         &argc);
+  free_tokens(argv);
+}
+
+static void bench_expand_vars(void) {
+  char *argv[] = {strdup("$HOME/${USER:-nobody}/src"), strdup("\"$A $B\""),
+                  strdup("${PATHLIKE%%:*}"), strdup("plain"), NULL};
+  expand_vars(argv, 4);
+  for (int i = 0; i < 4; i++) free(argv[i]);
+}
+
+static void bench_arith(void) {
+  int ok;
+  eval_arith("(1 + 2) * 3 - 4 / 2 + 17 % 5 + X * Y", &ok);
+}
+
+static void bench_alias(void) {
+  int argc = 2;
+  char **argv = malloc(3 * sizeof(char *));
+  argv[0] = strdup("ll");
+  argv[1] = strdup("/tmp");
+  argv[2] = NULL;
+  expand_aliases(&argv, &argc);
+  free_tokens(argv);
+}
+
+static char glob_dir[64];
+static char glob_pat[96];
+
+static void bench_glob(void) {
+  int count;
+  char **matches = glob_pattern(glob_pat, &count);
+  if (matches) free_tokens(matches);
+}
+
+static const char *loop_script =
+    "i=0\n"
+    "for x in a b c d e f g h; do\n"
+    "  case $x in\n"
+    "    a|b) i=$((i + 1)) ;;\n"
+    "    *) if [ $i -gt 3 ]; then echo big; else echo small; fi ;;\n"
+    "  esac\n"
+    "  while false; do :; done\n"
+    "done\n";
+
+static void bench_parse(void) {
+  int ok;
+  ASTNode *tree = parse_string(loop_script, &ok);
+  free_ast(tree);
+}
+
+#define HISTORY_ENTRIES 100000
+
+static void bench_history_search(void) {
+  history_search("deploy --env=prod-4217", HISTORY_ENTRIES);  // one old entry
+  history_search("no such command", HISTORY_ENTRIES);
+}
+
+static void setup_history(void) {
+  char line[128], size[16];
+  snprintf(size, sizeof(size), "%d", HISTORY_ENTRIES);
+  setenv("HISTFILE", "", 1);
+  set_var("HISTSIZE", size);
+  static const char *cmds[] = {"git status", "make -j8", "ls -la", "cd ..", "vim src/shell.c"};
+  for (int i = 0; i < HISTORY_ENTRIES; i++) {
+    if (i % 10 == 0)
+      snprintf(line, sizeof(line), "deploy --env=prod-%d --tag=v%d.%d", i / 10, i % 7, i % 13);
+    else
+      snprintf(line, sizeof(line), "%s # %d", cmds[i % 5], i);
+    add_to_history(line);
+  }
+}
+
+static void setup_in_process(void) {
+  set_var("USER", "bench");
+  set_var("A", "alpha");
+  set_var("B", "beta");
+  set_var("PATHLIKE", "/usr/local/bin:/usr/bin:/bin");
+  set_var("X", "6");
+  set_var("Y", "7");
+  set_alias("ll", "ls -l --color=auto");
+
+  snprintf(glob_dir, sizeof(glob_dir), "/tmp/ash_bench_XXXXXX");
+  if (!mkdtemp(glob_dir)) {
+    perror("mkdtemp");
+    exit(EXIT_FAILURE);
+  }
+  char path[128];
+  for (int i = 0; i < 200; i++) {
+    snprintf(path, sizeof(path), "%s/file%03d.%s", glob_dir, i, i % 2 ? "txt" : "c");
+    FILE *f = fopen(path, "w");
+    if (f) fclose(f);
+  }
+  snprintf(glob_pat, sizeof(glob_pat), "%s/*.txt", glob_dir);
+  setup_history();
+}
+
+static void cleanup_in_process(void) {
+  char path[128];
+  for (int i = 0; i < 200; i++) {
+    snprintf(path, sizeof(path), "%s/file%03d.%s", glob_dir, i, i % 2 ? "txt" : "c");
+    unlink(path);
+  }
+  rmdir(glob_dir);
+}
+
+// ---------------- Benchmarks through ./ash ----------------
+
+typedef struct {
+  const char *name;
+  const char *body;  // printf format for the script body, %d is the op count
+  int ops;           // operations the script performs per run
+} script_bench_t;
+
+static const char *ash_path;
+
+/* Run ash on script once and return the wall time in ns (negative on failure) */
+static double run_script(const char *script) {
+  char *argv[] = {(char *)ash_path, (char *)script, NULL};
+  pid_t pid;
+  posix_spawn_file_actions_t fa;
+  posix_spawn_file_actions_init(&fa);
+  posix_spawn_file_actions_addopen(&fa, STDOUT_FILENO, "/dev/null", O_WRONLY, 0);
+  double start = now_ns();
+  int rc = posix_spawn(&pid, ash_path, &fa, NULL, argv, environ);
+  posix_spawn_file_actions_destroy(&fa);
+  if (rc != 0) return -1;
+  int status;
+  waitpid(pid, &status, 0);
+  double elapsed = now_ns() - start;
+  return WIFEXITED(status) ? elapsed : -1;
+}
+
+static void run_script_bench(const script_bench_t *b, int samples) {
+  char script[] = "/tmp/ash_bench_script_XXXXXX";
+  int fd = mkstemp(script);
+  if (fd == -1) {
+    perror("mkstemp");
+    return;
+  }
+  FILE *f = fdopen(fd, "w");
+  fprintf(f, b->body, b->ops);
+  fclose(f);
+
+  double lat[SAMPLES];
+  double total = 0;
+  int n = 0;
+  for (int s = 0; s < samples + 1; s++) {
+    double elapsed = run_script(script);
+    if (elapsed < 0) {
+      fprintf(stderr, "bench: %s: %s failed\n", b->name, ash_path);
+      unlink(script);
+      return;
+    }
+    if (s == 0) continue;  // warm the page cache
+    lat[n++] = elapsed / b->ops;
+    total += elapsed;
+  }
+  unlink(script);
+  report(b->name, lat, n, (long)n * b->ops, total);
+}
+
+static const script_bench_t script_benches[] = {
+    {"script_loop",
+     "n=0\nfor i in $(seq %d); do\n  case $i in\n    *5) n=$((n + 2)) ;;\n"
+     "    *) n=$((n + 1)) ;;\n  esac\ndone\n",
+     2000},
+    {"fork_exec", "for i in $(seq %d); do /bin/true; done\n", 200},
+    {"pipeline_2", "for i in $(seq %d); do /bin/true | /bin/true; done\n", 100},
+    {"pipeline_8",
+     "for i in $(seq %d); do\n"
+     "  /bin/true | /bin/true | /bin/true | /bin/true | /bin/true | /bin/true | /bin/true | "
+     "/bin/true\ndone\n",
+     50},
+};
+
+int main(int argc, char **argv) {
+  const char *filter = argc > 1 ? argv[1] : NULL;
+  ash_path = getenv("ASH") ? getenv("ASH") : "./ash";
+
+  static const bench_t benches[] = {
+      {"split_command_line", bench_split, 2000}, {"expand_vars", bench_expand_vars, 2000},
+      {"eval_arith", bench_arith, 5000},         {"expand_aliases", bench_alias, 2000},
+      {"glob", bench_glob, 20},                  {"parse_string", bench_parse, 1000},
+      {"history_search", bench_history_search, 1000},
+  };
+
+  setup_in_process();
+  for (size_t i = 0; i < sizeof(benches) / sizeof(benches[0]); i++) {
+    if (filter && !strstr(benches[i].name, filter)) continue;
+    run_bench(&benches[i]);
+  }
+  cleanup_in_process();
+
+  if (access(ash_path, X_OK) != 0) {
+    fprintf(stderr, "bench: %s not found, skipping script benchmarks\n", ash_path);
+    return 0;
+  }
+  for (size_t i = 0; i < sizeof(script_benches) / sizeof(script_benches[0]); i++) {
+    if (filter && !strstr(script_benches[i].name, filter)) continue;
+    run_script_bench(&script_benches[i], 10);
+  }
+  return 0;
+}
@@ -3,6 +3,5 @@
 
 #include <stddef.h>
 long eval_arith(const char *expr, int *ok);
-char *expand_arith_subst(const char *arg);
 
 #endif
@@ -1,6 +1,18 @@
 #ifndef ASH_BUILTINS_H
 #define ASH_BUILTINS_H
 
-int handle_simple_builtin(char **args);
+/* Built-in flags */
+#define BUILTIN_SPECIAL 0x1   // POSIX special built-in: found before functions
+#define BUILTIN_NOFORK 0x2    // only writes output, never changes shell state
+#define BUILTIN_TERMINAL 0x4  // moves jobs to and from the terminal (job control only)
+
+typedef struct {
+  const char *name;
+  int (*run)(char **args);  // returns the exit status
+  int flags;
+} builtin_t;
+
+/* Look a built-in up by name; NULL if there is none */
+const builtin_t *find_builtin(const char *name);
 
 #endif
@@ -16,4 +16,12 @@
  */
 void expand_globs(char ***args_ptr, int *arg_count);
 
+/*
+ * glob_pattern - match a single pattern whose quoted characters are backslash-escaped.
+ *
+ * Returns a NULL-terminated array of matches (free with free_tokens) and stores the
+ * match count in *count, or returns NULL when nothing matches.
+ */
+char **glob_pattern(const char *pattern, int *count);
+
 #endif /* ASH_GLOBBING_H */
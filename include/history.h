@@ -1,7 +1,28 @@
 #ifndef ASH_HISTORY_H
 #define ASH_HISTORY_H
 
+/* Load the newest HISTSIZE entries of HISTFILE and share the list with readline (once) */
+void history_init(void);
+
+/* Record a command in the history and append it to HISTFILE */
 void add_to_history(const char *command);
+
 void show_history(void);
 
+/*
+ * Position (0 = oldest) of the newest entry before position before that contains
+ * pattern, or matches it anywhere if it has glob characters; -1 if none. Looked up in a
+ * trigram index, so the cost follows the number of candidates, not the history size.
+ */
+int history_search(const char *pattern, int before);
+
+/* The entry at a position history_search() returned; NULL if out of range */
+const char *history_entry(int pos);
+
+/* Print the entries matching pattern (history -s); returns how many there were */
+int show_history_matches(const char *pattern);
+
+/* Readline command for Ctrl-R: incremental reverse search through history_search() */
+int history_reverse_search(int count, int key);
+
 #endif
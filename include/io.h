@@ -1,6 +1,66 @@
 #ifndef ASH_IO_H
 #define ASH_IO_H
 
+#include <spawn.h>
+
+typedef enum {
+  REDIR_IN,       // [n]<file
+  REDIR_OUT,      // [n]>file, [n]>|file
+  REDIR_APPEND,   // [n]>>file
+  REDIR_RDWR,     // [n]<>file
+  REDIR_DUP,      // [n]>&m, [n]<&m
+  REDIR_CLOSE,    // [n]>&-, [n]<&-
+  REDIR_HEREDOC,  // [n]<<word whose body is still on stdin
+} redir_op_t;
+
+typedef struct {
+  int fd;              // descriptor being redirected
+  redir_op_t op;
+  const char *target;  // file name, delimiter or source descriptor (points into args)
+} redir_t;
+
+/*
+ * A command's words split into its argument vector and its redirections, in the order
+ * they appeared. argv is NULL-terminated and points into the original args.
+ */
+typedef struct {
+  char **argv;
+  int argc;
+  redir_t *items;
+  int count;
+} redir_list_t;
+
+/* Split args (already expanded). Returns 0, or -1 after printing a syntax error. */
+int parse_redirections(char **args, int arg_count, redir_list_t *out);
+void free_redirections(redir_list_t *r);
+
+/* Does the list read a here-document from the shell's own stdin? */
+int redirections_need_stdin(const redir_list_t *r);
+
+/*
+ * Open every file the list names (close-on-exec) into fds[i], -1 for entries that are
+ * not files. Used by the parent before posix_spawn(). Returns 0, or -1 after printing
+ * an error with nothing left open.
+ */
+int open_redirections(const redir_list_t *r, int *fds);
+void close_redirections(const redir_list_t *r, int *fds);
+
+/* Turn an opened list into spawn file actions, in order */
+int redirections_to_file_actions(const redir_list_t *r, const int *fds,
+                                 posix_spawn_file_actions_t *fa);
+
+/*
+ * Apply a list to the shell itself for a built-in, function or compound command,
+ * remembering each descriptor it replaces in saved[i]. Returns 0, or -1 after printing
+ * an error with everything undone. Standard output is flushed on both sides.
+ */
+int save_and_apply_redirections(const redir_list_t *r, int *saved);
+void restore_redirections(const redir_list_t *r, int *saved, int count);
+
+/*
+ * Apply the redirections in args to the current process and strip them from args.
+ * Meant for forked children; exits on failure.
+ */
 void handle_redirection(char **args, int *arg_count);
 
 #endif
@@ -2,46 +2,93 @@
 #define ASH_JOBS_H
 
 #include <sys/types.h>
+#include <sys/resource.h>
+#include <time.h>
 
-// Maximum number of background jobs we can track
-#define MAX_JOBS 32
-
-#ifndef MAX_INPUT_SIZE
-#define MAX_INPUT_SIZE 1024
-#endif
+// Accounting for one process of a job
+typedef struct {
+  struct timespec start;  // CLOCK_MONOTONIC when the job was started
+  struct timespec end;    // when the process was reaped; zero while it is not
+  struct rusage usage;    // from wait4() once it has finished
+} proc_usage_t;
 
 // Job info structure
 typedef struct job {
-  pid_t pid;                     // Process ID
+  pid_t pid;                     // Process ID of the first process
   pid_t pgid;                    // Process group ID
   int job_id;                    // Job number (starts at 1)
-  char command[MAX_INPUT_SIZE];  // Command string
+  char *command;                 // Command string (owned by the job)
   int running;                   // Is it running or stopped?
   int foreground;                // Is it in foreground?
   int notified;                  // Have we told the user about status changes?
+  int nprocs;                    // Processes in the job, one per pipeline stage
+  pid_t *pids;                   // Their process IDs, in pipeline order
+  int *status;                   // wait() status of each, -1 while running
+  int remaining;                 // Processes not finished yet
+  proc_usage_t *usage;           // Times and resource usage of each process
 } job_t;
 
-// Global job list
-extern job_t jobs[MAX_JOBS];
+// Number of jobs in the table. A job keeps its ID (and its job_t) until it is removed.
 extern int job_count;
 
 // Set up the job control system
 void jobs_init(void);
 
-// Add a new job to the list
-int add_job(pid_t pid, pid_t pgid, const char *command, int bg);
+// Add a new job made of nprocs processes (pids in pipeline order) to the list
+int add_job(pid_t pgid, const pid_t *pids, int nprocs, const char *command, int bg);
 
 // Remove a job from the list
 void remove_job(int job_id);
 
-// Print all jobs (for the jobs command)
-void list_jobs(void);
+// Print all jobs (for the jobs command); long_format adds a line per process with its
+// times and resource usage
+void list_jobs(int long_format);
 
-// Find a job by its process ID
+// Find a job by its number; NULL if there is none
+job_t *find_job(int job_id);
+
+// Find the job one of whose processes has this ID
 job_t *find_job_by_pid(pid_t pid);
 
-// Check if background jobs have finished
-void check_background_jobs(void);
+// Find the job named by a job spec: %n, %+ (or %% or %), %-, %string (command starts
+// with string) or %?string (command contains it). NULL if none, or more than one, match.
+job_t *find_job_spec(const char *spec);
+
+// Jobs in ID order: next_job(NULL) is the first, NULL follows the last
+job_t *next_job(const job_t *job);
+
+// Make a job the current one (%+); the old current job becomes the previous one (%-)
+void set_current_job(job_t *job);
+
+// Record a wait() status for one of the job's processes; returns 1 once all have finished
+int job_process_done(job_t *job, pid_t pid, int wstatus);
+
+// Exit status of a finished job (that of its last process)
+int job_exit_status(const job_t *job);
+
+// Note the rusage of a reaped child for take_child_peak_rss()
+void note_child_usage(const struct rusage *usage);
+
+// Largest max RSS (KB) among children noted since the last call, which starts afresh
+long take_child_peak_rss(void);
+
+// Format seconds as "XmY.YYYs", as time and times print them
+void format_duration(char *buf, size_t size, double seconds);
+
+// Exit code for a wait() status: the exit status, or 128 + signal number if killed
+int wait_exit_code(int wstatus);
+
+// Reap job processes that changed state (never blocks); returns how many did
+int reap_jobs(void);
+
+// Wait up to timeout_ms (-1: no limit) for a child to change state, then reap_jobs()
+int wait_for_job_event(int timeout_ms);
+
+// Descriptor that becomes readable when a child changes state (-1 if unavailable)
+int jobs_event_fd(void);
+
+// Print finished and newly stopped background jobs; returns how many were reported
+int check_background_jobs(void);
 
 // Job control helpers (implemented in shell.c)
 void continue_job(job_t *job, int foreground);
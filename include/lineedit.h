@@ -0,0 +1,38 @@
+#ifndef ASH_LINEEDIT_H
+#define ASH_LINEEDIT_H
+
+#include <stdio.h>
+#include <readline/readline.h>
+#include <readline/history.h>
+
+/*
+ * GNU readline, opened with dlopen() the first time an interactive shell needs it, so
+ * -c commands and scripts never map the library or pay for its relocations. The headers
+ * are used for types only: every call goes through these entry points.
+ */
+typedef struct {
+  char *(*readline)(const char *prompt);
+  int (*initialize)(void);
+  int (*bind_key)(int key, rl_command_func_t *function);
+  rl_command_func_t *complete;
+  int (*getc)(FILE *stream);
+  int (*on_new_line)(void);
+  void (*redisplay)(void);
+  void (*replace_line)(const char *text, int clear_undo);
+  int (*message)(const char *format, ...);
+  int (*clear_message)(void);
+  int (*read_key)(void);
+  int (*execute_next)(int key);
+  void (*set_history_state)(HISTORY_STATE *state);
+  int *point;                      // rl_point
+  char **line_buffer;              // rl_line_buffer
+  rl_getc_func_t **getc_function;  // rl_getc_function
+} line_editor_t;
+
+/* The loaded library; NULL until load_line_editor() succeeds */
+extern const line_editor_t *line_editor;
+
+/* Load readline (once); 0 on success, -1 if it is not available */
+int load_line_editor(void);
+
+#endif
@@ -0,0 +1,19 @@
+#ifndef ASH_OPTIONS_H
+#define ASH_OPTIONS_H
+
+/* Shell options switched with set -o name / set +o name */
+typedef enum {
+  OPT_LASTPIPE,  // run a built-in or compound last pipeline stage in the shell
+  OPT_PIPEFAIL,  // a pipeline's status is its rightmost failing stage
+  OPT_COUNT
+} shell_option_t;
+
+extern int shell_options[OPT_COUNT];
+
+/* Turn a named option on or off; -1 if there is no such option */
+int set_shell_option(const char *name, int on);
+
+/* Print every option as set -o would list it */
+void print_shell_options(void);
+
+#endif /* ASH_OPTIONS_H */
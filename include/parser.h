@@ -9,25 +9,77 @@ typedef enum
   NODE_IF,
   NODE_WHILE,
   NODE_FOR,
+  NODE_PIPELINE,
+  NODE_AND_OR,
+  NODE_CASE,
+  NODE_CASE_ITEM,
+  NODE_FUNCTION,
+  NODE_GROUP,
+  NODE_SUBSHELL,
 } NodeType;
 
+/* Node flags */
+#define NODE_BG 0x01     // list element terminated by '&'
+#define NODE_AND 0x02    // and-or node joined with '&&'
+#define NODE_OR 0x04     // and-or node joined with '||'
+#define NODE_NEGATE 0x08 // pipeline prefixed with '!'
+#define NODE_UNTIL 0x10  // while node is really an until loop
+#define NODE_TIMED 0x20  // pipeline prefixed with 'time'
+#define NODE_TIME_POSIX 0x40 // 'time -p': POSIX output format
+
+/*
+ * Field usage by node type:
+ *   COMMAND    argv/argc hold the pre-tokenized words (redirection operators included)
+ *   IF         cond, body, else_branch (an elif chain is a nested IF in else_branch)
+ *   WHILE      cond, body
+ *   FOR        var_name, for_list (NULL means the positional parameters), body
+ *   PIPELINE   body is the list of stages
+ *   AND_OR     cond is the left side, body the right side, flags say && or ||
+ *   CASE       var_name is the word, body the list of CASE_ITEMs
+ *   CASE_ITEM  for_list holds the patterns, body the commands
+ *   FUNCTION   var_name is the name, body the compound command
+ *   GROUP      body ({ list; })
+ *   SUBSHELL   body (( list ))
+ */
 typedef struct ASTNode
 {
   NodeType type;
+  int flags;
   char **argv;                 // for simple commands
+  int argc;
   struct ASTNode *cond;        // for control nodes: condition command
   struct ASTNode *body;        // first stmt in body (linked list via next)
   struct ASTNode *else_branch; // for if
   struct ASTNode *next;        // linked list of statements at same level
-  char *var_name;              // for for-loop variable
+  char *var_name;              // for-loop variable
   char **for_list;             // list of words in for loop
+  char *heredoc_path;          // temp file holding a here-document body
 } ASTNode;
 
-ASTNode *parse_stream(FILE *fp);
+/*
+ * Parse and run a script one complete command at a time. Returns the status of the
+ * last command (2 on a syntax error).
+ */
+int parse_stream(FILE *fp);
+
+/* Parse a string into an AST without running it. *ok is cleared on syntax errors. */
+ASTNode *parse_string(const char *src, int *ok);
+
 void free_ast(ASTNode *node);
-void exec_ast(ASTNode *node);
 
-/* Executes a user-defined shell function if it exists. Returns 1 if executed, 0 otherwise. */
-int exec_function_if_defined(char **argv, int argc);
+/* Run a statement list (node and its next siblings). Returns the last status. */
+int exec_ast(ASTNode *node);
+
+/* Run a single node, ignoring node->next. */
+int exec_node(ASTNode *node);
+
+/* Body of a user-defined shell function, or NULL */
+ASTNode *find_function(const char *name);
+
+/*
+ * Executes a user-defined shell function if it exists. Returns 1 if executed (with its
+ * exit status stored in *status), 0 otherwise.
+ */
+int exec_function_if_defined(char **argv, int argc, int *status);
 
 #endif
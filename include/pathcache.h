@@ -0,0 +1,33 @@
+#ifndef ASH_PATHCACHE_H
+#define ASH_PATHCACHE_H
+
+/*
+ * Command path cache (the "hash" table). Resolves a command name through $PATH once and
+ * remembers the result until PATH changes or the table is cleared.
+ */
+
+/*
+ * Full path to run for name, or NULL if it is not found in PATH. Names containing a '/'
+ * are returned unchanged. Each successful lookup counts as a hit.
+ */
+const char *lookup_command_path(const char *name);
+
+/*
+ * hash name: resolve name through PATH again, even if it is remembered, and record it
+ * with no hits yet. Returns the path, or NULL if it is not found.
+ */
+const char *hash_command_path(const char *name);
+
+/*
+ * execve() a resolved path, falling back to execvp() when the cached file has gone away
+ * or is a script without a #! line. SIGCHLD is unblocked first. Only returns on failure.
+ */
+void exec_command_path(const char *path, char **args);
+
+/* Forget every remembered path (hash -r) */
+void clear_command_paths(void);
+
+/* Print remembered paths with their hit counts */
+void list_command_paths(void);
+
+#endif /* ASH_PATHCACHE_H */
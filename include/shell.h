@@ -1,4 +1,23 @@
 #ifndef ASH_SHELL_H
 #define ASH_SHELL_H
+#include "parser.h"
+
 int parse_and_execute(char *input);
+
+/* Status of the last command ($?) */
+extern int last_status;
+
+/* Executors for leaf AST nodes (see exec_ast() in parser.c). Return the exit status. */
+int execute_simple(ASTNode *cmd);
+int execute_pipeline(ASTNode *pipeline);
+
+/* Start a compound command as a background job */
+int execute_background(ASTNode *node);
+
+/* Run a pipeline prefixed with 'time' and report how long it took and what it used */
+int execute_timed(ASTNode *pipeline);
+
+/* End --startup-profile's "run" phase and print the report, if not printed yet. Called
+ * on the way out of a -c command or script, including by exit, which skips atexit(). */
+void profile_finish(void);
 #endif
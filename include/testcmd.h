@@ -0,0 +1,14 @@
+#ifndef ASH_TESTCMD_H
+#define ASH_TESTCMD_H
+
+/* test / [ : args is the expanded command line. Returns 0 (true), 1 (false) or 2 (error) */
+int builtin_test(char **args);
+
+/*
+ * [[ ... ]]: words are the command's unexpanded words, words[0] being "[[" and the last
+ * "]]". Supports && || ! ( ), pattern matching with == and !=, =~ regular expressions and
+ * < > string comparison, plus everything test does.
+ */
+int builtin_cond(char **words, int count);
+
+#endif
@@ -1,14 +1,60 @@
 #ifndef ASH_VARS_H
 #define ASH_VARS_H
 
-#define MAX_VARS 64
-#define MAX_VAR_NAME 64
-#define MAX_VAR_VALUE 256
+#include <stddef.h>
 
+/* Names and values may be of any length; values are copied into the store */
 void set_var(const char *name, const char *value);
 const char *get_var(const char *name);
+
+/* Lookup by a name that is not NUL-terminated (e.g. a slice of a word being expanded) */
+const char *get_var_n(const char *name, size_t len);
+
+/*
+ * Stable handle to a variable, created unset if needed. Lets hot callers (compiled
+ * arithmetic) resolve a name once and read it many times.
+ */
+struct var *var_slot(const char *name, size_t len);
+
+/* Numeric value of a slot (atol semantics, cached until the next set). 0 if unset or empty. */
+long var_slot_number(struct var *v);
+
+/* Assign a number to a slot (arithmetic assignment operators) */
+void var_slot_set_number(struct var *v, long n);
+/*
+ * Word expansion. Each word is walked once: tilde, parameter ($NAME, ${NAME...}, $?, ...),
+ * command ($(...), `...`) and arithmetic ($((...))) expansion, then field splitting on
+ * IFS and pathname expansion of unquoted results, with quote removal.
+ */
+
+/* Set (never cleared) when an expansion fails, e.g. on an arithmetic error; the command
+ * whose words are being expanded should then not run */
+extern int expansion_failed;
+/* Full expansion of an argv; returns a new NULL-terminated array (free with free_tokens) */
+char **expand_words(char **words, int count, int *out_count);
+
+/* Expand one word to a single string: no field splitting or pathname expansion */
+char *expand_word(const char *word);
+
+/* Like expand_word(), but quoted pattern characters are backslash-escaped for fnmatch() */
+char *expand_pattern(const char *word);
+
+/* expand_word() on each argument in place */
 void expand_vars(char **args, int arg_count);
 
+/*
+ * Run cmd in a subshell and return its output with all trailing newlines removed (and
+ * NUL bytes dropped); the length is stored in *len. Returns NULL if cmd could not run.
+ */
+char *capture_command_output(const char *cmd, size_t *len);
+
+/*
+ * Fast path for capture_command_output(): run cmd inside the shell with stdout sent to
+ * an in-memory file. Returns 1 with the raw output in *out and its length in *len, or 0 if cmd needs a
+ * real subshell.
+ */
+int capture_in_process(const char *cmd, char **out, size_t *len);
+
 /* Export variable to process environment. Returns 0 on success, -1 if undefined or setenv failed */
 int export_var(const char *name);
 
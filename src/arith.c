@@ -5,176 +5,659 @@
 #include <stdlib.h>
 #include <stdio.h>
 
-/* Simple recursive-descent evaluator supporting + - * / % and parentheses */
-static const char *p;
-static int ok_flag;
+/*
+ * POSIX shell arithmetic: the full $(( )) operator set with C precedence, decimal, octal
+ * (leading 0) and hex (0x) constants, and 64-bit two's complement wrap-around on
+ * overflow. Shift counts are taken modulo 64.
+ *
+ * An expression is compiled once by a recursive-descent parser into a small stack-machine
+ * program whose variable references are already resolved to slots in the variable store.
+ * Programs are cached by expression text, so a loop re-evaluating "i + 1" only hashes the
+ * text and runs the program. Compiler and evaluator keep their state on the C stack; the
+ * cache is the only global.
+ */
 
-static long parse_expr();
-static long parse_term();
-static long parse_factor();
+typedef enum
+{
+  OP_CONST,  // push num
+  OP_VAR,    // push the numeric value of slot (0 if unset)
+  OP_STORE,  // assign top of stack to slot, leaving it on the stack
+  OP_DUP,
+  OP_POP,
+  OP_NEG,
+  OP_NOT,
+  OP_BNOT,
+  OP_BOOL,   // top = top != 0
+  OP_ADD,
+  OP_SUB,
+  OP_MUL,
+  OP_DIV,
+  OP_MOD,
+  OP_SHL,
+  OP_SHR,
+  OP_LT,
+  OP_LE,
+  OP_GT,
+  OP_GE,
+  OP_EQ,
+  OP_NE,
+  OP_BAND,
+  OP_BXOR,
+  OP_BOR,
+  OP_JMP,    // jump to num
+  OP_JZ,     // pop; jump to num if it was 0
+  OP_AND_JZ, // if top is 0 jump to num keeping it, else pop (&& short-circuit)
+  OP_OR_JNZ, // if top is non-zero make it 1 and jump to num, else pop (||)
+} arith_opcode_t;
 
-static void skip_ws()
+typedef struct
 {
-  while (*p && isspace((unsigned char)*p))
-    p++;
-}
+  arith_opcode_t op;
+  long num;
+  struct var *slot;
+} arith_insn_t;
 
-static long parse_number()
+typedef struct
 {
-  skip_ws();
-  long val = 0;
-  int neg = 0;
-  if (*p == '-')
-  {
-    neg = 1;
-    p++;
-  }
-  if (!isdigit((unsigned char)*p))
+  char *text; // expression the program was compiled from
+  unsigned int hash;
+  int valid;  // 0 if the text is not a valid expression
+  arith_insn_t *code;
+  int len;
+  int max_depth; // stack slots needed to run it
+} arith_prog_t;
+
+typedef struct
+{
+  const char *p;
+  int ok;
+  arith_insn_t *code;
+  int len;
+  int cap;
+  int depth;
+  int max_depth;
+} compiler_t;
+
+static void compile_comma(compiler_t *C);
+static void compile_assign(compiler_t *C);
+static void compile_unary(compiler_t *C);
+
+/* Net stack effect of each opcode */
+static int stack_effect(arith_opcode_t op)
+{
+  switch (op)
   {
-    ok_flag = 0;
+  case OP_CONST:
+  case OP_VAR:
+  case OP_DUP:
+    return 1;
+  case OP_STORE:
+  case OP_NEG:
+  case OP_NOT:
+  case OP_BNOT:
+  case OP_BOOL:
+  case OP_JMP:
     return 0;
+  default:
+    return -1;
   }
-  while (isdigit((unsigned char)*p))
+}
+
+/* Append an instruction; returns its index so jumps can be patched */
+static int emit(compiler_t *C, arith_opcode_t op, long num, struct var *slot)
+{
+  if (C->len == C->cap)
   {
-    val = val * 10 + (*p - '0');
-    p++;
+    int cap = C->cap ? C->cap * 2 : 16;
+    arith_insn_t *code = realloc(C->code, cap * sizeof(arith_insn_t));
+    if (!code)
+    {
+      perror("realloc");
+      exit(EXIT_FAILURE);
+    }
+    C->code = code;
+    C->cap = cap;
   }
-  return neg ? -val : val;
+  C->code[C->len] = (arith_insn_t){op, num, slot};
+  C->depth += stack_effect(op);
+  if (C->depth > C->max_depth)
+    C->max_depth = C->depth;
+  return C->len++;
+}
+
+static void patch(compiler_t *C, int at)
+{
+  C->code[at].num = C->len;
+}
+
+static void skip_ws(compiler_t *C)
+{
+  while (*C->p && isspace((unsigned char)*C->p))
+    C->p++;
 }
 
-static long parse_var()
+/*
+ * Consume operator op if it comes next and is not the start of a longer operator, i.e.
+ * not followed by any character in reject.
+ */
+static int accept(compiler_t *C, const char *op, const char *reject)
 {
-  skip_ws();
-  char name[64];
-  int n = 0;
-  while (isalnum((unsigned char)*p) || *p == '_')
+  skip_ws(C);
+  size_t n = strlen(op);
+  if (strncmp(C->p, op, n) != 0)
+    return 0;
+  if (C->p[n] && reject && strchr(reject, C->p[n]))
+    return 0;
+  C->p += n;
+  return 1;
+}
+
+static int is_name_start(int c)
+{
+  return isalpha(c) || c == '_';
+}
+
+/* Integer constant; digits accumulate in unsigned arithmetic so overflow wraps */
+static void compile_number(compiler_t *C)
+{
+  unsigned long val = 0;
+  int base = 10;
+  if (C->p[0] == '0' && (C->p[1] == 'x' || C->p[1] == 'X'))
   {
-    if (n < 63)
-      name[n++] = *p;
-    p++;
+    base = 16;
+    C->p += 2;
+    if (!isxdigit((unsigned char)*C->p))
+      C->ok = 0;
   }
-  name[n] = '\0';
-  const char *v = get_var(name);
-  if (!v)
+  else if (C->p[0] == '0')
   {
-    ok_flag = 0;
-    return 0;
+    base = 8;
+  }
+  for (;; C->p++)
+  {
+    int c = (unsigned char)*C->p;
+    int d;
+    if (isdigit(c))
+      d = c - '0';
+    else if (isxdigit(c) && base == 16)
+      d = tolower(c) - 'a' + 10;
+    else
+      break;
+    if (d >= base)
+    {
+      C->ok = 0;
+      return;
+    }
+    val = val * base + d;
   }
-  return atol(v);
+  if (is_name_start((unsigned char)*C->p))
+    C->ok = 0; // e.g. 12abc
+  emit(C, OP_CONST, (long)val, NULL);
+}
+
+static struct var *parse_name(compiler_t *C)
+{
+  skip_ws(C);
+  const char *start = C->p;
+  if (!is_name_start((unsigned char)*C->p))
+    return NULL;
+  while (isalnum((unsigned char)*C->p) || *C->p == '_')
+    C->p++;
+  return var_slot(start, C->p - start);
+}
+
+/* var += delta, leaving either the new or the old value */
+static void emit_increment(compiler_t *C, struct var *slot, long delta, int postfix)
+{
+  emit(C, OP_VAR, 0, slot);
+  if (postfix)
+    emit(C, OP_DUP, 0, NULL);
+  emit(C, OP_CONST, delta, NULL);
+  emit(C, OP_ADD, 0, NULL);
+  emit(C, OP_STORE, 0, slot);
+  if (postfix)
+    emit(C, OP_POP, 0, NULL);
 }
 
-static long parse_factor()
+static void compile_primary(compiler_t *C)
 {
-  skip_ws();
-  if (*p == '(')
+  skip_ws(C);
+  if (*C->p == '(')
   {
-    p++;
-    long v = parse_expr();
-    skip_ws();
-    if (*p != ')')
+    C->p++;
+    compile_comma(C);
+    skip_ws(C);
+    if (*C->p != ')')
     {
-      ok_flag = 0;
-      return 0;
+      C->ok = 0;
+      return;
     }
-    p++;
-    return v;
+    C->p++;
+    return;
   }
-  if (isdigit((unsigned char)*p) || (*p == '-' && isdigit((unsigned char)*(p + 1))))
-    return parse_number();
+  if (isdigit((unsigned char)*C->p))
+  {
+    compile_number(C);
+    return;
+  }
+  struct var *slot = parse_name(C);
+  if (!slot)
+  {
+    C->ok = 0;
+    return;
+  }
+  if (accept(C, "++", NULL))
+    emit_increment(C, slot, 1, 1);
+  else if (accept(C, "--", NULL))
+    emit_increment(C, slot, -1, 1);
   else
-    return parse_var();
+    emit(C, OP_VAR, 0, slot);
 }
 
-static long parse_term()
+static void compile_unary(compiler_t *C)
 {
-  long v = parse_factor();
-  while (1)
+  if (!C->ok)
+    return;
+  // ++name / --name; otherwise the two characters are two unary operators
+  const char *save = C->p;
+  if (accept(C, "++", NULL) || accept(C, "--", NULL))
   {
-    skip_ws();
-    if (*p == '*')
+    long delta = C->p[-1] == '+' ? 1 : -1;
+    struct var *slot = parse_name(C);
+    if (slot)
     {
-      p++;
-      v *= parse_factor();
+      emit_increment(C, slot, delta, 0);
+      return;
     }
-    else if (*p == '/' || *p == '%')
+    C->p = save;
+  }
+  if (accept(C, "-", "="))
+  {
+    compile_unary(C);
+    emit(C, OP_NEG, 0, NULL);
+  }
+  else if (accept(C, "+", "="))
+  {
+    compile_unary(C);
+  }
+  else if (accept(C, "!", "="))
+  {
+    compile_unary(C);
+    emit(C, OP_NOT, 0, NULL);
+  }
+  else if (accept(C, "~", NULL))
+  {
+    compile_unary(C);
+    emit(C, OP_BNOT, 0, NULL);
+  }
+  else
+  {
+    compile_primary(C);
+  }
+}
+
+/*
+ * Left-associative binary operator levels, loosest to tightest. Each operator lists the
+ * characters that must not follow it (so '<' is not taken from "<<" or "<=").
+ */
+typedef struct
+{
+  const char *op;
+  const char *reject;
+  arith_opcode_t code;
+} binop_t;
+
+static const binop_t level_bor[] = {{"|", "|=", OP_BOR}, {NULL, NULL, 0}};
+static const binop_t level_bxor[] = {{"^", "=", OP_BXOR}, {NULL, NULL, 0}};
+static const binop_t level_band[] = {{"&", "&=", OP_BAND}, {NULL, NULL, 0}};
+static const binop_t level_eq[] = {{"==", NULL, OP_EQ}, {"!=", NULL, OP_NE}, {NULL, NULL, 0}};
+static const binop_t level_rel[] = {{"<=", NULL, OP_LE},
+                                    {">=", NULL, OP_GE},
+                                    {"<", "<", OP_LT},
+                                    {">", ">", OP_GT},
+                                    {NULL, NULL, 0}};
+static const binop_t level_shift[] = {{"<<", "=", OP_SHL}, {">>", "=", OP_SHR}, {NULL, NULL, 0}};
+static const binop_t level_add[] = {{"+", "+=", OP_ADD}, {"-", "-=", OP_SUB}, {NULL, NULL, 0}};
+static const binop_t level_mul[] = {
+    {"*", "=", OP_MUL}, {"/", "=", OP_DIV}, {"%", "=", OP_MOD}, {NULL, NULL, 0}};
+
+static const binop_t *const levels[] = {level_bor,   level_bxor, level_band, level_eq,
+                                        level_rel,   level_shift, level_add, level_mul};
+#define NLEVELS ((int)(sizeof(levels) / sizeof(levels[0])))
+
+static void compile_binary(compiler_t *C, int level)
+{
+  if (level == NLEVELS)
+  {
+    compile_unary(C);
+    return;
+  }
+  compile_binary(C, level + 1);
+  while (C->ok)
+  {
+    const binop_t *b = levels[level];
+    while (b->op && !accept(C, b->op, b->reject))
+      b++;
+    if (!b->op)
+      break;
+    compile_binary(C, level + 1);
+    emit(C, b->code, 0, NULL);
+  }
+}
+
+static void compile_land(compiler_t *C)
+{
+  compile_binary(C, 0);
+  while (C->ok && accept(C, "&&", NULL))
+  {
+    int jump = emit(C, OP_AND_JZ, 0, NULL);
+    compile_binary(C, 0);
+    emit(C, OP_BOOL, 0, NULL);
+    patch(C, jump);
+  }
+}
+
+static void compile_lor(compiler_t *C)
+{
+  compile_land(C);
+  while (C->ok && accept(C, "||", NULL))
+  {
+    int jump = emit(C, OP_OR_JNZ, 0, NULL);
+    compile_land(C);
+    emit(C, OP_BOOL, 0, NULL);
+    patch(C, jump);
+  }
+}
+
+static void compile_ternary(compiler_t *C)
+{
+  compile_lor(C);
+  if (!C->ok || !accept(C, "?", NULL))
+    return;
+  int to_else = emit(C, OP_JZ, 0, NULL);
+  compile_comma(C);
+  if (!accept(C, ":", NULL))
+  {
+    C->ok = 0;
+    return;
+  }
+  int to_end = emit(C, OP_JMP, 0, NULL);
+  patch(C, to_else);
+  C->depth--; // only one of the two branches pushes at run time
+  compile_assign(C);
+  patch(C, to_end);
+}
+
+static const binop_t assign_ops[] = {
+    {"*=", NULL, OP_MUL},  {"/=", NULL, OP_DIV},  {"%=", NULL, OP_MOD},  {"+=", NULL, OP_ADD},
+    {"-=", NULL, OP_SUB},  {"<<=", NULL, OP_SHL}, {">>=", NULL, OP_SHR}, {"&=", NULL, OP_BAND},
+    {"^=", NULL, OP_BXOR}, {"|=", NULL, OP_BOR},  {"=", "=", OP_STORE},  {NULL, NULL, 0}};
+
+static void compile_assign(compiler_t *C)
+{
+  if (!C->ok)
+    return;
+  // NAME followed by an assignment operator? Otherwise rewind and parse a conditional.
+  const char *save = C->p;
+  struct var *slot = parse_name(C);
+  if (slot)
+  {
+    const binop_t *a = assign_ops;
+    while (a->op && !accept(C, a->op, a->reject))
+      a++;
+    if (a->op)
     {
-      int op = *p;
-      p++;
-      long rhs = parse_factor();
-      if (rhs == 0)
-      {
-        ok_flag = 0;
-        return 0;
-      }
-      v = (op == '/') ? v / rhs : v % rhs;
+      if (a->code != OP_STORE)
+        emit(C, OP_VAR, 0, slot);
+      compile_assign(C);
+      if (a->code != OP_STORE)
+        emit(C, a->code, 0, NULL);
+      emit(C, OP_STORE, 0, slot);
+      return;
     }
-    else
-      break;
   }
-  return v;
+  C->p = save;
+  compile_ternary(C);
 }
 
-static long parse_expr()
+static void compile_comma(compiler_t *C)
 {
-  long v = parse_term();
-  while (1)
+  compile_assign(C);
+  while (C->ok && accept(C, ",", NULL))
   {
-    skip_ws();
-    if (*p == '+')
+    emit(C, OP_POP, 0, NULL);
+    compile_assign(C);
+  }
+}
+
+static void compile(arith_prog_t *prog)
+{
+  compiler_t C = {.p = prog->text, .ok = 1};
+  compile_comma(&C);
+  skip_ws(&C);
+  if (*C.p != '\0')
+    C.ok = 0;
+  prog->valid = C.ok;
+  prog->code = C.code;
+  prog->len = C.len;
+  prog->max_depth = C.max_depth;
+}
+
+/* Wrapping two's complement arithmetic (signed overflow is undefined in C) */
+#define WRAP(a, op, b) ((long)((unsigned long)(a) op (unsigned long)(b)))
+
+static long run(const arith_prog_t *prog, int *ok)
+{
+  long small[32];
+  long *stack = small;
+  if (prog->max_depth > 32)
+  {
+    stack = malloc(prog->max_depth * sizeof(long));
+    if (!stack)
     {
-      p++;
-      v += parse_term();
+      *ok = 0;
+      return 0;
     }
-    else if (*p == '-')
+  }
+
+  int sp = 0;
+  *ok = 1;
+  for (int pc = 0; pc < prog->len && *ok; pc++)
+  {
+    const arith_insn_t *in = &prog->code[pc];
+    long *top = sp ? &stack[sp - 1] : stack;
+    switch (in->op)
     {
-      p++;
-      v -= parse_term();
+    case OP_CONST:
+      stack[sp++] = in->num;
+      continue;
+    case OP_VAR:
+      stack[sp++] = var_slot_number(in->slot);
+      continue;
+    case OP_STORE:
+      var_slot_set_number(in->slot, *top);
+      continue;
+    case OP_DUP:
+      stack[sp] = *top;
+      sp++;
+      continue;
+    case OP_POP:
+      sp--;
+      continue;
+    case OP_NEG:
+      *top = WRAP(0, -, *top);
+      continue;
+    case OP_NOT:
+      *top = !*top;
+      continue;
+    case OP_BNOT:
+      *top = ~*top;
+      continue;
+    case OP_BOOL:
+      *top = *top != 0;
+      continue;
+    case OP_JMP:
+      pc = in->num - 1;
+      continue;
+    case OP_JZ:
+      sp--;
+      if (*top == 0)
+        pc = in->num - 1;
+      continue;
+    case OP_AND_JZ:
+      if (*top == 0)
+        pc = in->num - 1;
+      else
+        sp--;
+      continue;
+    case OP_OR_JNZ:
+      if (*top != 0)
+      {
+        *top = 1;
+        pc = in->num - 1;
+      }
+      else
+        sp--;
+      continue;
+    default:
+      break;
     }
-    else
+
+    // Binary operators
+    long rhs = stack[--sp];
+    long *lhs = &stack[sp - 1];
+    switch (in->op)
+    {
+    case OP_ADD:
+      *lhs = WRAP(*lhs, +, rhs);
+      break;
+    case OP_SUB:
+      *lhs = WRAP(*lhs, -, rhs);
+      break;
+    case OP_MUL:
+      *lhs = WRAP(*lhs, *, rhs);
+      break;
+    case OP_DIV:
+    case OP_MOD:
+      if (rhs == 0)
+        *ok = 0;
+      else if (rhs == -1) // LONG_MIN / -1 wraps to LONG_MIN, remainder 0
+        *lhs = in->op == OP_DIV ? WRAP(0, -, *lhs) : 0;
+      else
+        *lhs = in->op == OP_DIV ? *lhs / rhs : *lhs % rhs;
+      break;
+    case OP_SHL:
+      *lhs = WRAP(*lhs, <<, rhs & 63);
+      break;
+    case OP_SHR:
+      *lhs >>= rhs & 63;
       break;
+    case OP_LT:
+      *lhs = *lhs < rhs;
+      break;
+    case OP_LE:
+      *lhs = *lhs <= rhs;
+      break;
+    case OP_GT:
+      *lhs = *lhs > rhs;
+      break;
+    case OP_GE:
+      *lhs = *lhs >= rhs;
+      break;
+    case OP_EQ:
+      *lhs = *lhs == rhs;
+      break;
+    case OP_NE:
+      *lhs = *lhs != rhs;
+      break;
+    case OP_BAND:
+      *lhs &= rhs;
+      break;
+    case OP_BXOR:
+      *lhs ^= rhs;
+      break;
+    case OP_BOR:
+      *lhs |= rhs;
+      break;
+    default:
+      break;
+    }
   }
+  long v = *ok ? stack[0] : 0;
+  if (stack != small)
+    free(stack);
   return v;
 }
 
+/* Program cache: open addressing on the expression text, flushed wholesale when full */
+#define ARITH_CACHE_SIZE 512
+#define ARITH_CACHE_MAX (ARITH_CACHE_SIZE * 3 / 4)
+
+static arith_prog_t *cache[ARITH_CACHE_SIZE];
+static int cache_count;
+
+static unsigned int hash_text(const char *s)
+{
+  unsigned int h = 2166136261u; // FNV-1a
+  for (; *s; s++)
+  {
+    h ^= (unsigned char)*s;
+    h *= 16777619u;
+  }
+  return h;
+}
+
+static void flush_cache(void)
+{
+  for (int i = 0; i < ARITH_CACHE_SIZE; i++)
+  {
+    if (!cache[i])
+      continue;
+    free(cache[i]->text);
+    free(cache[i]->code);
+    free(cache[i]);
+    cache[i] = NULL;
+  }
+  cache_count = 0;
+}
+
+static arith_prog_t *lookup_prog(const char *expr)
+{
+  unsigned int h = hash_text(expr);
+  size_t i = h & (ARITH_CACHE_SIZE - 1);
+  while (cache[i])
+  {
+    if (cache[i]->hash == h && strcmp(cache[i]->text, expr) == 0)
+      return cache[i];
+    i = (i + 1) & (ARITH_CACHE_SIZE - 1);
+  }
+
+  if (cache_count >= ARITH_CACHE_MAX)
+  {
+    flush_cache();
+    i = h & (ARITH_CACHE_SIZE - 1);
+  }
+  arith_prog_t *prog = calloc(1, sizeof(arith_prog_t));
+  if (!prog || !(prog->text = strdup(expr)))
+  {
+    perror("malloc");
+    exit(EXIT_FAILURE);
+  }
+  prog->hash = h;
+  compile(prog);
+  cache[i] = prog;
+  cache_count++;
+  return prog;
+}
+
 long eval_arith(const char *expr, int *ok)
 {
-  p = expr;
-  ok_flag = 1;
-  long v = parse_expr();
-  skip_ws();
-  if (*p != '\0')
-    ok_flag = 0;
+  int ok_flag = 0;
+  long v = 0;
+  const arith_prog_t *prog = lookup_prog(expr);
+  if (prog->valid)
+    v = run(prog, &ok_flag);
   if (ok)
     *ok = ok_flag;
   return v;
 }
-
-/* Expand first $(( expr )) in arg, returns newly allocated string or NULL if none */
-char *expand_arith_subst(const char *arg)
-{
-  const char *start = strstr(arg, "$((");
-  if (!start)
-    return NULL;
-  const char *end = strstr(start + 3, "))");
-  if (!end)
-    return NULL;
-  char expr[256];
-  size_t elen = end - (start + 3);
-  if (elen >= sizeof(expr))
-    return NULL;
-  memcpy(expr, start + 3, elen);
-  expr[elen] = '\0';
-  int ok;
-  long val = eval_arith(expr, &ok);
-  if (!ok)
-    return NULL;
-  char num[64];
-  snprintf(num, sizeof(num), "%ld", val);
-  size_t newlen = strlen(arg) - (end + 2 - start) + strlen(num) + 1;
-  char *out = malloc(newlen);
-  size_t prefix = start - arg;
-  memcpy(out, arg, prefix);
-  strcpy(out + prefix, num);
-  strcat(out, end + 2);
-  return out;
-}
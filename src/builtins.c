@@ -1,3 +1,5 @@
+#define _GNU_SOURCE /* F_GETPIPE_SZ */
+
 #include "builtins.h"
 #include "vars.h"
 #include "parser.h"
@@ -6,144 +8,829 @@
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
+#include <ctype.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <signal.h>
 #include "alias.h"
+#include "pathcache.h"
+#include "testcmd.h"
+#include "history.h"
+#include "jobs.h"
+#include "options.h"
+#include "shell.h"
+#include "terminal.h"
 
-extern int last_status;
+// ---------------- echo / printf ------------------
 
-int handle_simple_builtin(char **args) {
-  if (args[0] == NULL) return 0;
+/*
+ * Output the escape sequence after a backslash; *pp points at the character following
+ * it and is left on the last character consumed. echo_style selects \0nnn octal (echo,
+ * %b) over \nnn (printf formats). Returns -1 for \c (stop all output), else 0.
+ */
+static int put_escape(const char **pp, int echo_style) {
+  const char *p = *pp;
+  int c;
+  switch (*p) {
+    case 'a': c = '\a'; break;
+    case 'b': c = '\b'; break;
+    case 'f': c = '\f'; break;
+    case 'n': c = '\n'; break;
+    case 'r': c = '\r'; break;
+    case 't': c = '\t'; break;
+    case 'v': c = '\v'; break;
+    case '\\': c = '\\'; break;
+    case 'c':
+      return -1;
+    case '\0':
+      putchar('\\');
+      *pp = p - 1;
+      return 0;
+    default:
+      if (*p >= '0' && *p <= '7') {
+        int max = 3;
+        if (echo_style && *p == '0') {
+          p++;  // \0nnn
+        }
+        c = 0;
+        for (; max > 0 && *p >= '0' && *p <= '7'; max--, p++) c = c * 8 + (*p - '0');
+        putchar(c);
+        *pp = p - 1;
+        return 0;
+      }
+      putchar('\\');
+      c = *p;
+      break;
+  }
+  putchar(c);
+  *pp = p;
+  return 0;
+}
 
-  // cd
-  if (strcmp(args[0], "cd") == 0) {
-    const char *dir = args[1] ? args[1] : getenv("HOME");
-    if (chdir(dir) != 0) {
-      perror("cd");
-      last_status = 1;
-    } else
-      last_status = 0;
-    return 1;
+/* Print s interpreting backslash escapes; returns -1 if \c cut the output short */
+static int put_escaped(const char *s, int echo_style) {
+  for (; *s; s++) {
+    if (*s != '\\') {
+      putchar(*s);
+      continue;
+    }
+    s++;
+    if (put_escape(&s, echo_style) == -1) return -1;
   }
+  return 0;
+}
 
-  // history handled in shell.c
+static int builtin_echo(char **args) {
+  int newline = 1, escapes = 0, i = 1;
+  // Leading options made only of n, e and E; anything else is output
+  for (; args[i] && args[i][0] == '-' && args[i][1]; i++) {
+    if (strspn(args[i] + 1, "neE") != strlen(args[i] + 1)) break;
+    for (const char *o = args[i] + 1; *o; o++) {
+      if (*o == 'n') newline = 0;
+      else escapes = (*o == 'e');
+    }
+  }
+  for (; args[i]; i++) {
+    if (escapes) {
+      if (put_escaped(args[i], 1) == -1) return 0;
+    } else {
+      fputs(args[i], stdout);
+    }
+    if (args[i + 1]) putchar(' ');
+  }
+  if (newline) putchar('\n');
+  return 0;
+}
+
+/* Numeric printf argument: C constants, or 'c / "c for a character code */
+static int printf_number(const char *arg, long long *out) {
+  if (!arg) {
+    *out = 0;
+    return 0;
+  }
+  if (arg[0] == '\'' || arg[0] == '"') {
+    *out = (unsigned char)arg[1];
+    return 0;
+  }
+  char *end;
+  errno = 0;
+  *out = strtoll(arg, &end, 0);
+  if (end == arg || *end || errno) {
+    fprintf(stderr, "printf: %s: invalid number\n", arg);
+    return 1;
+  }
+  return 0;
+}
 
-  // exit
-  if (strcmp(args[0], "exit") == 0) {
-    printf("Exiting shell...\n");
-    exit(EXIT_SUCCESS);
+static int builtin_printf(char **args) {
+  if (!args[1]) {
+    fprintf(stderr, "printf: usage: printf format [arguments]\n");
+    return 2;
   }
+  const char *fmt = args[1];
+  char **av = args + 2;
+  int status = 0;
 
-  // source (delegates to parser)
-  if (strcmp(args[0], "source") == 0) {
-    if (!args[1]) {
-      fprintf(stderr, "source: filename required\n");
-      last_status = 1;
-      return 1;
+  // The format is reused while arguments remain (and it consumes any)
+  for (;;) {
+    char **start = av;
+    for (const char *f = fmt; *f; f++) {
+      if (*f == '\\') {
+        f++;
+        if (put_escape(&f, 0) == -1) return status;
+        continue;
+      }
+      if (*f != '%') {
+        putchar(*f);
+        continue;
+      }
+      if (f[1] == '%') {
+        putchar('%');
+        f++;
+        continue;
+      }
+
+      // %[flags][width][.precision]conv, with * taking a width from the arguments
+      char spec[64];
+      size_t n = 0;
+      spec[n++] = '%';
+      const char *q = f + 1;
+      while (*q && strchr("-+ #0", *q) && n < 20) spec[n++] = *q++;
+      for (int part = 0; part < 2; part++) {
+        if (part == 1) {
+          if (*q != '.') break;
+          spec[n++] = *q++;
+        }
+        if (*q == '*') {
+          long long w;
+          status |= printf_number(*av, &w);
+          if (*av) av++;
+          n += snprintf(spec + n, sizeof(spec) - n - 8, "%d", (int)w);
+          q++;
+        } else {
+          while (isdigit((unsigned char)*q) && n < 40) spec[n++] = *q++;
+        }
+      }
+      char conv = *q;
+      if (!conv || !strchr("sbcdiouxXeEfFgGaA", conv)) {
+        fprintf(stderr, "printf: %%%c: invalid directive\n", conv ? conv : ' ');
+        return 1;
+      }
+      f = q;
+      const char *arg = *av;
+      if (arg) av++;
+
+      if (conv == 's' || conv == 'c' || conv == 'b') {
+        char one[2] = {arg ? arg[0] : '\0', '\0'};
+        if (conv == 'b') {
+          if (put_escaped(arg ? arg : "", 1) == -1) return status;
+          continue;
+        }
+        spec[n++] = 's';
+        spec[n] = '\0';
+        printf(spec, conv == 'c' ? one : (arg ? arg : ""));
+      } else if (strchr("eEfFgGaA", conv)) {
+        double d = 0;
+        if (arg) {
+          char *end;
+          d = strtod(arg, &end);
+          if (end == arg || *end) {
+            fprintf(stderr, "printf: %s: invalid number\n", arg);
+            status = 1;
+          }
+        }
+        spec[n++] = conv;
+        spec[n] = '\0';
+        printf(spec, d);
+      } else {
+        long long v;
+        status |= printf_number(arg, &v);
+        spec[n++] = 'l';
+        spec[n++] = 'l';
+        spec[n++] = conv;
+        spec[n] = '\0';
+        if (conv == 'd' || conv == 'i')
+          printf(spec, v);
+        else
+          printf(spec, (unsigned long long)v);
+      }
     }
-    FILE *fp = fopen(args[1], "r");
-    if (!fp) {
-      perror("source");
-      last_status = 1;
-      return 1;
+    if (!*av || av == start) break;
+  }
+  return status;
+}
+
+// ---------------- read ------------------
+
+typedef struct {
+  char *data;
+  size_t len;
+  size_t cap;
+} line_t;
+
+static void line_append(line_t *l, const char *s, size_t n) {
+  if (l->len + n + 1 > l->cap) {
+    while (l->len + n + 1 > l->cap) l->cap = l->cap ? l->cap * 2 : 128;
+    l->data = realloc(l->data, l->cap);
+  }
+  memcpy(l->data + l->len, s, n);
+  l->len += n;
+  l->data[l->len] = '\0';
+}
+
+#define READ_CHUNK 4096
+
+/*
+ * Append one line from fd (without its newline) to l. Seekable input is read in chunks
+ * and the offset moved back to just past the newline, so the next command sees the rest
+ * of the file; pipes and terminals cannot be un-read and go a byte at a time. Returns 0
+ * at end of input before any newline, 1 otherwise.
+ */
+static int read_fd_line(int fd, line_t *l) {
+  char chunk[READ_CHUNK];
+  int seekable = !isatty(fd) && lseek(fd, 0, SEEK_CUR) != -1;
+  for (;;) {
+    ssize_t n = read(fd, chunk, seekable ? sizeof(chunk) : 1);
+    if (n < 0 && errno == EINTR) continue;
+    if (n <= 0) return 0;
+    char *nl = memchr(chunk, '\n', n);
+    if (!nl) {
+      line_append(l, chunk, n);
+      continue;
     }
-    parse_stream(fp);
-    fclose(fp);
-    last_status = 0;
+    line_append(l, chunk, nl - chunk);
+    if (seekable && nl + 1 < chunk + n) lseek(fd, (nl + 1) - (chunk + n), SEEK_CUR);
     return 1;
   }
+}
 
-  // export
-  if (strcmp(args[0], "export") == 0) {
-    if (!args[1]) {
-      fprintf(stderr, "export: var required\n");
-      last_status = 1;
-      return 1;
+static int builtin_read(char **args) {
+  int raw = 0, i = 1;
+  const char *prompt = NULL;
+  for (; args[i] && args[i][0] == '-' && args[i][1]; i++) {
+    if (strcmp(args[i], "--") == 0) {
+      i++;
+      break;
+    } else if (strcmp(args[i], "-r") == 0) {
+      raw = 1;
+    } else if (strcmp(args[i], "-p") == 0 && args[i + 1]) {
+      prompt = args[++i];
+    } else {
+      fprintf(stderr, "read: %s: invalid option\n", args[i]);
+      return 2;
     }
-    for (int i = 1; args[i]; i++) {
-      char *eq = strchr(args[i], '=');
-      if (eq && eq != args[i]) {
-        *eq = '\0';
-        set_var(args[i], eq + 1);
-        setenv(args[i], eq + 1, 1);
-      } else if (export_var(args[i]) != 0) {
-        fprintf(stderr, "export: %s undefined\n", args[i]);
-        last_status = 1;
+  }
+  char *reply[] = {"REPLY", NULL};
+  char **names = args[i] ? args + i : reply;
+
+  if (prompt && isatty(STDIN_FILENO)) {
+    fputs(prompt, stderr);
+    fflush(stderr);
+  }
+
+  // Read the line; without -r a trailing backslash continues it
+  line_t l = {0};
+  line_append(&l, "", 0);
+  int got;
+  for (;;) {
+    size_t start = l.len;
+    got = read_fd_line(STDIN_FILENO, &l);
+    if (raw || !got) break;
+    size_t bs = 0;
+    for (size_t k = l.len; k > start && l.data[k - 1] == '\\'; k--) bs++;
+    if (bs % 2 == 0) break;
+    l.data[--l.len] = '\0';
+  }
+
+  // Remove backslash quoting, remembering which characters were escaped
+  char *esc = calloc(l.len + 1, 1);
+  size_t len = 0;
+  for (size_t k = 0; k < l.len; k++) {
+    if (!raw && l.data[k] == '\\' && k + 1 < l.len) {
+      esc[len] = 1;
+      k++;
+    }
+    l.data[len++] = l.data[k];
+  }
+  l.data[len] = '\0';
+
+  // Split on IFS: whitespace separators collapse, the last name takes the rest
+  const char *ifs = get_var("IFS");
+  if (!ifs) ifs = " \t\n";
+#define IS_IFS(k) (!esc[k] && l.data[k] && strchr(ifs, l.data[k]))
+#define IS_IFS_WS(k) (IS_IFS(k) && isspace((unsigned char)l.data[k]))
+  size_t k = 0;
+  while (k < len && IS_IFS_WS(k)) k++;
+  for (int v = 0; names[v]; v++) {
+    size_t begin = k, end;
+    if (!names[v + 1]) {
+      end = len;
+      while (end > begin && IS_IFS_WS(end - 1)) end--;
+      k = len;
+    } else {
+      while (k < len && !IS_IFS(k)) k++;
+      end = k;
+      // one separator: surrounding whitespace plus at most one non-whitespace delimiter
+      while (k < len && IS_IFS_WS(k)) k++;
+      if (k < len && IS_IFS(k) && !IS_IFS_WS(k)) {
+        k++;
+        while (k < len && IS_IFS_WS(k)) k++;
       }
     }
-    last_status = 0;
+    char saved = l.data[end];
+    l.data[end] = '\0';
+    set_var(names[v], l.data + begin);
+    l.data[end] = saved;
+  }
+#undef IS_IFS
+#undef IS_IFS_WS
+  free(esc);
+  free(l.data);
+  return got ? 0 : 1;
+}
+
+// ---------------- shell state ------------------
+
+static int builtin_true(char **args) {
+  (void)args;
+  return 0;
+}
+
+static int builtin_false(char **args) {
+  (void)args;
+  return 1;
+}
+
+static int builtin_cd(char **args) {
+  const char *dir = args[1] ? args[1] : getenv("HOME");
+  if (chdir(dir) != 0) {
+    perror("cd");
     return 1;
   }
+  return 0;
+}
 
-  // let builtin
-  if (strcmp(args[0], "let") == 0) {
-    int ok;
-    long res = 0;
-    for (int i = 1; args[i]; i++) {
-      res = eval_arith(args[i], &ok);
+/* [[ normally runs from execute_simple(), which still has the unexpanded words */
+static int builtin_cond_words(char **args) {
+  int count = 0;
+  while (args[count]) count++;
+  return builtin_cond(args, count);
+}
+
+// hash [-r] [name...]
+static int builtin_hash(char **args) {
+  int status = 0;
+  if (!args[1]) {
+    list_command_paths();
+    return 0;
+  }
+  for (int i = 1; args[i]; i++) {
+    if (strcmp(args[i], "-r") == 0) {
+      clear_command_paths();
+    } else if (!hash_command_path(args[i])) {
+      fprintf(stderr, "hash: %s: not found\n", args[i]);
+      status = 1;
     }
-    last_status = (res == 0);
+  }
+  return status;
+}
+
+// exit [n]: leave with status n, or that of the last command
+static int builtin_exit(char **args) {
+  int status = args[1] ? atoi(args[1]) & 0xff : last_status;
+  if (shell_is_interactive) printf("Exiting shell...\n");
+  fflush(stdout);
+  profile_finish();
+  _exit(status);  // exit() would rewind a script being read from the same fd
+}
+
+// source (delegates to parser)
+static int builtin_source(char **args) {
+  if (!args[1]) {
+    fprintf(stderr, "source: filename required\n");
     return 1;
   }
+  FILE *fp = fopen(args[1], "r");
+  if (!fp) {
+    perror("source");
+    return 1;
+  }
+  int status = parse_stream(fp);  // that of the last command run
+  fclose(fp);
+  return status;
+}
 
-  // alias
-  if (strcmp(args[0], "alias") == 0) {
-    if (!args[1]) {
-      list_aliases();
-      last_status = 0;
-      return 1;
-    }
-    for (int i = 1; args[i]; i++) {
-      char *eq = strchr(args[i], '=');
-      if (eq) {
-        *eq = '\0';
-        char *val = eq + 1;
-
-        /* If nothing after '=', treat following tokens as value */
-        if (*val == '\0') {
-          /* Concatenate remaining args into a single string */
-          size_t buflen = 0;
-          for (int j = i + 1; args[j]; j++) buflen += strlen(args[j]) + 1;
-          char *tmp = malloc(buflen + 1);
-          tmp[0] = '\0';
-          for (int j = i + 1; args[j]; j++) {
-            strcat(tmp, args[j]);
-            if (args[j + 1]) strcat(tmp, " ");
-          }
-          val = tmp;
-        }
+static int builtin_export(char **args) {
+  if (!args[1]) {
+    fprintf(stderr, "export: var required\n");
+    return 1;
+  }
+  for (int i = 1; args[i]; i++) {
+    char *eq = strchr(args[i], '=');
+    if (eq && eq != args[i]) {
+      *eq = '\0';
+      set_var(args[i], eq + 1);
+      setenv(args[i], eq + 1, 1);
+    } else if (export_var(args[i]) != 0) {
+      fprintf(stderr, "export: %s undefined\n", args[i]);
+    }
+  }
+  return 0;
+}
 
-        /* Strip surrounding quotes if present */
-        size_t len = strlen(val);
-        if (len >= 2 &&
-            ((val[0] == '"' && val[len - 1] == '"') || (val[0] == '\'' && val[len - 1] == '\''))) {
-          val[len - 1] = '\0';
-          val++;
-        }
+static int builtin_let(char **args) {
+  int ok;
+  long res = 0;
+  for (int i = 1; args[i]; i++) {
+    res = eval_arith(args[i], &ok);
+  }
+  return res == 0;
+}
 
-        set_alias(args[i], val);
-        if (*(eq + 1) == '\0') {
-          free(val);
-          break; /* we consumed rest */
+static int builtin_alias(char **args) {
+  if (!args[1]) {
+    list_aliases();
+    return 0;
+  }
+  for (int i = 1; args[i]; i++) {
+    char *eq = strchr(args[i], '=');
+    if (eq) {
+      *eq = '\0';
+      char *val = eq + 1;
+
+      /* If nothing after '=', treat following tokens as value */
+      if (*val == '\0') {
+        /* Concatenate remaining args into a single string */
+        size_t buflen = 0;
+        for (int j = i + 1; args[j]; j++) buflen += strlen(args[j]) + 1;
+        char *tmp = malloc(buflen + 1);
+        tmp[0] = '\0';
+        for (int j = i + 1; args[j]; j++) {
+          strcat(tmp, args[j]);
+          if (args[j + 1]) strcat(tmp, " ");
         }
-      } else {
-        const char *v = get_alias(args[i]);
-        if (v) printf("alias %s='%s'\n", args[i], v);
+        val = tmp;
+      }
+
+      /* Strip surrounding quotes if present */
+      size_t len = strlen(val);
+      char *start = val;
+      if (len >= 2 &&
+          ((val[0] == '"' && val[len - 1] == '"') || (val[0] == '\'' && val[len - 1] == '\''))) {
+        val[len - 1] = '\0';
+        start++;
+      }
+
+      set_alias(args[i], start);
+      if (*(eq + 1) == '\0') {
+        free(val);
+        break; /* we consumed rest */
       }
+    } else {
+      const char *v = get_alias(args[i]);
+      if (v) printf("alias %s='%s'\n", args[i], v);
     }
-    last_status = 0;
+  }
+  return 0;
+}
+
+static int builtin_unalias(char **args) {
+  if (!args[1]) {
+    fprintf(stderr, "unalias: name required\n");
     return 1;
   }
+  for (int i = 1; args[i]; i++) unset_alias(args[i]);
+  return 0;
+}
 
-  // unalias
-  if (strcmp(args[0], "unalias") == 0) {
-    if (!args[1]) {
-      fprintf(stderr, "unalias: name required\n");
-      last_status = 1;
-      return 1;
+// set -o name / set +o name; with no option name, list the options
+static int builtin_set(char **args) {
+  if (!args[1]) {
+    print_shell_options();
+    return 0;
+  }
+  int status = 0;
+  for (int i = 1; args[i]; i++) {
+    int on = strcmp(args[i], "-o") == 0;
+    if (!on && strcmp(args[i], "+o") != 0) {
+      fprintf(stderr, "set: %s: invalid option\n", args[i]);
+      return 2;
+    }
+    if (!args[i + 1]) {
+      print_shell_options();
+      break;
+    }
+    if (set_shell_option(args[++i], on) == -1) {
+      fprintf(stderr, "set: %s: invalid option name\n", args[i]);
+      status = 1;
     }
-    for (int i = 1; args[i]; i++) unset_alias(args[i]);
-    last_status = 0;
-    return 1;
   }
+  return status;
+}
+
+/*
+ * pipesize [fd...]: report the buffer size of the pipes on the given descriptors
+ * (default 0 and 1), to check what PIPEBUF achieved. Written to stderr, as stdout is
+ * usually the pipe being measured.
+ */
+static int builtin_pipesize(char **args) {
+  char *standard[] = {"0", "1", NULL};
+  char **fds = args[1] ? args + 1 : standard;
+  int status = 0;
+  for (int i = 0; fds[i]; i++) {
+    char *end;
+    long fd = strtol(fds[i], &end, 10);
+    if (end == fds[i] || *end || fd < 0 || fd > INT_MAX) {
+      fprintf(stderr, "pipesize: %s: invalid descriptor\n", fds[i]);
+      status = 1;
+      continue;
+    }
+    int size = fcntl((int)fd, F_GETPIPE_SZ);
+    if (size == -1) {
+      fprintf(stderr, "pipesize: fd %ld: not a pipe\n", fd);
+      status = 1;
+    } else {
+      fprintf(stderr, "pipesize: fd %ld: %d bytes\n", fd, size);
+    }
+  }
+  return status;
+}
 
+// ---------------- history / jobs ------------------
+
+/* history [-s pattern]: list the history, or only the entries matching pattern */
+static int builtin_history(char **args) {
+  if (args[1] && strcmp(args[1], "-s") == 0) {
+    if (!args[2]) {
+      fprintf(stderr, "history: -s: pattern required\n");
+      return 2;
+    }
+    return show_history_matches(args[2]) ? 0 : 1;
+  }
+  show_history();
+  return 0;
+}
+
+/* jobs [-l]: -l adds each process with its times and resource usage */
+static int builtin_jobs(char **args) {
+  int long_format = 0;
+  for (int i = 1; args[i]; i++) {
+    if (strcmp(args[i], "-l") != 0) {
+      fprintf(stderr, "jobs: usage: jobs [-l]\n");
+      return 2;
+    }
+    long_format = 1;
+  }
+  list_jobs(long_format);
+  return 0;
+}
+
+/* times: user and system time of the shell, then of the children it has waited for */
+static int builtin_times(char **args) {
+  (void)args;
+  int who[] = {RUSAGE_SELF, RUSAGE_CHILDREN};
+  for (int i = 0; i < 2; i++) {
+    struct rusage usage;
+    char user[32], sys[32];
+    getrusage(who[i], &usage);
+    format_duration(user, sizeof(user), usage.ru_utime.tv_sec + usage.ru_utime.tv_usec / 1e6);
+    format_duration(sys, sizeof(sys), usage.ru_stime.tv_sec + usage.ru_stime.tv_usec / 1e6);
+    printf("%s %s\n", user, sys);
+  }
   return 0;
 }
+
+/* Job named by a wait/fg/bg operand: a %job spec, or a bare n that is a job number (for
+ * wait, a process ID) */
+static job_t *job_from_arg(const char *arg, int bare_is_pid) {
+  if (arg[0] == '%') return find_job_spec(arg);
+  char *end;
+  long n = strtol(arg, &end, 10);
+  if (end == arg || *end || n <= 0 || n > INT_MAX) return NULL;
+  if (bare_is_pid) return find_job_by_pid((pid_t)n);
+  return find_job((int)n);
+}
+
+/* fg and bg: resume job args[1] (default: the current job) in the foreground or the
+ * background */
+static int resume_job(char **args, int foreground) {
+  const char *spec = args[1] ? args[1] : "%+";
+  job_t *job = job_from_arg(spec, 0);
+  if (!job) {
+    fprintf(stderr, "%s: no such job: %s\n", args[0], args[1] ? args[1] : "current");
+    return 1;
+  }
+  int job_id = job->job_id;
+  set_current_job(job);
+  if (foreground)
+    printf("Bringing job %d to foreground: %s\n", job_id, job->command);
+  else
+    printf("Running job %d in background: %s\n", job_id, job->command);
+  continue_job(job, foreground);
+  if (foreground && job->remaining == 0) {
+    int status = job_exit_status(job);
+    remove_job(job_id);
+    return status;
+  }
+  return 0;
+}
+
+/* Signal number for a name (TERM or SIGTERM, any case) or a number; -1 if unknown */
+static int signal_from_name(const char *name) {
+  char *end;
+  long n = strtol(name, &end, 10);
+  if (end != name && !*end) return n >= 0 && n < NSIG ? (int)n : -1;
+  if (strncasecmp(name, "SIG", 3) == 0) name += 3;
+  for (int sig = 1; sig < NSIG; sig++) {
+    const char *abbrev = sigabbrev_np(sig);
+    if (abbrev && strcasecmp(abbrev, name) == 0) return sig;
+  }
+  return -1;
+}
+
+/* Send sig to a job: its process group, or each live process if it has none */
+static int signal_job(job_t *job, int sig) {
+  if (job->pgid > 0) return kill(-job->pgid, sig);
+  int result = 0;
+  for (int k = 0; k < job->nprocs; k++)
+    if (job->status[k] == -1 && kill(job->pids[k], sig) == -1) result = -1;
+  return result;
+}
+
+/* kill [-s sig | -sig] pid | %job ...; kill -l lists the signal names */
+static int builtin_kill(char **args) {
+  int sig = SIGTERM, i = 1;
+  if (args[1] && strcmp(args[1], "-l") == 0) {
+    for (int s = 1; s < NSIG; s++)
+      if (sigabbrev_np(s)) printf("%d) SIG%s\n", s, sigabbrev_np(s));
+    return 0;
+  }
+  if (args[1] && strcmp(args[1], "-s") == 0 && args[2]) {
+    sig = signal_from_name(args[2]);
+    i = 3;
+  } else if (args[1] && args[1][0] == '-' && args[1][1] && strcmp(args[1], "--") != 0) {
+    sig = signal_from_name(args[1] + 1);
+    i = 2;
+  }
+  if (sig == -1) {
+    fprintf(stderr, "kill: %s: invalid signal\n", args[i - 1]);
+    return 1;
+  }
+  if (args[i] && strcmp(args[i], "--") == 0) i++;
+  if (!args[i]) {
+    fprintf(stderr, "kill: usage: kill [-s sig | -sig] pid | %%job ...\n");
+    return 1;
+  }
+
+  int status = 0;
+  for (; args[i]; i++) {
+    if (args[i][0] == '%') {
+      job_t *job = find_job_spec(args[i]);
+      if (!job) {
+        fprintf(stderr, "kill: %s: no such job\n", args[i]);
+        status = 1;
+        continue;
+      }
+      if (signal_job(job, sig) == -1) {
+        fprintf(stderr, "kill: %s: %s\n", args[i], strerror(errno));
+        status = 1;
+      } else if (!job->running && (sig == SIGTERM || sig == SIGHUP)) {
+        signal_job(job, SIGCONT);  // a stopped job would not see the signal until resumed
+      }
+      continue;
+    }
+    char *end;
+    long pid = strtol(args[i], &end, 10);
+    if (end == args[i] || *end) {
+      fprintf(stderr, "kill: %s: arguments must be process or job IDs\n", args[i]);
+      status = 1;
+    } else if (kill((pid_t)pid, sig) == -1) {
+      fprintf(stderr, "kill: (%ld): %s\n", pid, strerror(errno));
+      status = 1;
+    }
+  }
+  return status;
+}
+
+/* Status of a job wait returned for, forgetting it if it finished (not just stopped) */
+static int collect_job(job_t *job) {
+  if (job->remaining > 0) return 128 + SIGTSTP;
+  int status = job_exit_status(job);
+  remove_job(job->job_id);
+  return status;
+}
+
+/*
+ * wait [-n] [%job | pid ...]: wait for the given jobs, or all of them, and return the
+ * status of the last; -n returns as soon as any one finishes. Sleeps on child events.
+ */
+static int builtin_wait(char **args) {
+  int any = 0, i = 1;
+  if (args[1] && strcmp(args[1], "-n") == 0) {
+    any = 1;
+    i++;
+  }
+
+  // Held as job IDs: a job_t is freed when its job is removed
+  int count = 0, status = 0;
+  for (char **a = args + i; *a; a++) count++;
+  int *ids = malloc((count ? count : job_count + 1) * sizeof(int));
+  if (!ids) return 1;
+  if (count) {
+    int n = 0;
+    for (char **a = args + i; *a; a++) {
+      job_t *job = job_from_arg(*a, 1);
+      if (job) {
+        ids[n++] = job->job_id;
+      } else {
+        fprintf(stderr, "wait: %s: no such job\n", *a);
+        status = 127;
+      }
+    }
+    count = n;
+  } else {
+    for (job_t *job = next_job(NULL); job; job = next_job(job)) ids[count++] = job->job_id;
+  }
+
+  if (any) {
+    // First of the jobs to finish (or stop)
+    status = 127;
+    for (;;) {
+      int waiting = 0;
+      for (int k = 0; k < count; k++) {
+        job_t *job = find_job(ids[k]);
+        if (!job) continue;
+        if (job->remaining == 0 || !job->running) {
+          status = collect_job(job);
+          waiting = -1;
+          break;
+        }
+        waiting++;
+      }
+      if (waiting <= 0) break;
+      wait_for_job_event(-1);
+    }
+  } else {
+    for (int k = 0; k < count; k++) {
+      job_t *job = find_job(ids[k]);
+      while (job && job->remaining > 0 && job->running) {
+        wait_for_job_event(-1);
+        job = find_job(ids[k]);
+      }
+      if (job) status = collect_job(job);
+    }
+    if (!args[i]) status = 0;
+  }
+  free(ids);
+  return status;
+}
+
+static int builtin_fg(char **args) {
+  return resume_job(args, 1);
+}
+
+static int builtin_bg(char **args) {
+  return resume_job(args, 0);
+}
+
+// ---------------- dispatch ------------------
+
+/* Sorted by strcmp() order for find_builtin()'s binary search */
+static const builtin_t builtin_table[] = {
+    {":", builtin_true, BUILTIN_SPECIAL | BUILTIN_NOFORK},
+    {"[", builtin_test, BUILTIN_NOFORK},
+    {"[[", builtin_cond_words, BUILTIN_NOFORK},
+    {"alias", builtin_alias, 0},
+    {"bg", builtin_bg, BUILTIN_TERMINAL},
+    {"cd", builtin_cd, 0},
+    {"echo", builtin_echo, BUILTIN_NOFORK},
+    {"exit", builtin_exit, BUILTIN_SPECIAL},
+    {"export", builtin_export, BUILTIN_SPECIAL},
+    {"false", builtin_false, BUILTIN_NOFORK},
+    {"fg", builtin_fg, BUILTIN_TERMINAL},
+    {"hash", builtin_hash, 0},
+    {"history", builtin_history, BUILTIN_NOFORK},
+    {"jobs", builtin_jobs, BUILTIN_NOFORK},
+    {"kill", builtin_kill, 0},
+    {"let", builtin_let, 0},
+    {"pipesize", builtin_pipesize, BUILTIN_NOFORK},
+    {"printf", builtin_printf, BUILTIN_NOFORK},
+    {"read", builtin_read, 0},
+    {"set", builtin_set, BUILTIN_SPECIAL},
+    {"source", builtin_source, BUILTIN_SPECIAL},
+    {"test", builtin_test, BUILTIN_NOFORK},
+    {"times", builtin_times, BUILTIN_SPECIAL | BUILTIN_NOFORK},
+    {"true", builtin_true, BUILTIN_NOFORK},
+    {"unalias", builtin_unalias, 0},
+    {"wait", builtin_wait, 0},
+};
+
+static int compare_builtin(const void *name, const void *entry) {
+  return strcmp(name, ((const builtin_t *)entry)->name);
+}
+
+const builtin_t *find_builtin(const char *name) {
+  return bsearch(name, builtin_table, sizeof(builtin_table) / sizeof(builtin_table[0]),
+                 sizeof(builtin_table[0]), compare_builtin);
+}
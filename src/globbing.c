@@ -115,3 +115,22 @@ bail:
   free(newargv);
   return;
 }
+
+char **glob_pattern(const char *pattern, int *count) {
+  glob_t g;
+  if (glob(pattern, GLOB_ERR, NULL, &g) != 0) {
+    globfree(&g);
+    return NULL;
+  }
+  char **matches = malloc((g.gl_pathc + 1) * sizeof(char *));
+  if (!matches) {
+    perror("malloc");
+    globfree(&g);
+    return NULL;
+  }
+  for (size_t k = 0; k < g.gl_pathc; k++) matches[k] = strdup(g.gl_pathv[k]);
+  matches[g.gl_pathc] = NULL;
+  *count = (int)g.gl_pathc;
+  globfree(&g);
+  return matches;
+}
@@ -1,37 +1,651 @@
+#define _GNU_SOURCE /* memrchr */
 #include "history.h"
-#include <string.h>
+#include "lineedit.h"
+#include "vars.h"
+#include <ctype.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <fnmatch.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#define DEFAULT_HISTSIZE 1000
+#define MAX_HISTSIZE (1 << 24)
+
+/*
+ * The last HISTSIZE commands, oldest first, as a window sliding along an array of twice
+ * that many readline history entries: the live ones are always the contiguous run
+ * ring[start] .. ring[start + count - 1]. That run is readline's history list itself,
+ * so the arrow keys and Ctrl-R walk these entries and readline's own edits to them
+ * (it replaces and frees entries) land here; each entry has this one pointer. Once the
+ * window reaches the end of the array it is moved back to the front, which keeps adding
+ * O(1) amortized; once full, the oldest entry is freed as a new one comes in. Like
+ * readline's own list, the run is followed by a NULL.
+ */
+static HIST_ENTRY **ring;
+static int capacity;
+static int start;
+static int count;
+static int loaded;
+
+/*
+ * Search index: for every trigram (three consecutive bytes) seen in an entry, the
+ * ascending sequence numbers of the entries holding it. Entries are numbered as they
+ * are added, so the live ones are next_seq - count .. next_seq - 1 and appending keeps
+ * every list sorted. Evicted entries are skipped at lookup and the index is rebuilt
+ * from the live ones once as many have been evicted as there are slots.
+ */
+typedef struct {
+  unsigned int trigram; /* the three bytes; 0 marks an empty slot */
+  unsigned int *seqs;
+  int len, cap;
+} trigram_list_t;
+
+#define INDEX_MIN 1024
+
+static trigram_list_t *trigrams;
+static size_t trigrams_cap;
+static size_t trigrams_count;
+static unsigned int next_seq;
+static unsigned int stale;
+
+/* HISTSIZE as a shell or environment variable, else the default */
+static int history_size_setting(void)
+{
+  const char *value = get_var("HISTSIZE");
+  if (!value)
+    value = getenv("HISTSIZE");
+  if (!value || !*value)
+    return DEFAULT_HISTSIZE;
+  char *end;
+  long n = strtol(value, &end, 10);
+  if (*end || n < 0)
+    return DEFAULT_HISTSIZE;
+  return n > MAX_HISTSIZE ? MAX_HISTSIZE : (int)n;
+}
+
+/* HISTFILE, else ~/.ash_history; NULL when HISTFILE is set but empty (no file) */
+static const char *history_file_path(void)
+{
+  static char *default_path;
+  const char *value = get_var("HISTFILE");
+  if (!value)
+    value = getenv("HISTFILE");
+  if (value)
+    return *value ? value : NULL;
+  if (!default_path)
+  {
+    const char *home = getenv("HOME");
+    if (!home)
+      return NULL;
+    size_t len = strlen(home) + sizeof("/.ash_history");
+    default_path = malloc(len);
+    if (default_path)
+      snprintf(default_path, len, "%s/.ash_history", home);
+  }
+  return default_path;
+}
+
+static size_t hash_trigram(unsigned int trigram, size_t cap)
+{
+  return (trigram * 2654435761u) & (cap - 1);
+}
+
+/* The list for a trigram; with create, add an empty one if there is none */
+static trigram_list_t *find_trigram(unsigned int trigram, int create)
+{
+  if (trigrams_cap)
+  {
+    for (size_t i = hash_trigram(trigram, trigrams_cap); trigrams[i].trigram;
+         i = (i + 1) & (trigrams_cap - 1))
+    {
+      if (trigrams[i].trigram == trigram)
+        return &trigrams[i];
+    }
+  }
+  if (!create)
+    return NULL;
+
+  if ((trigrams_count + 1) * 2 > trigrams_cap)
+  {
+    size_t new_cap = trigrams_cap ? trigrams_cap * 2 : INDEX_MIN;
+    trigram_list_t *grown = calloc(new_cap, sizeof(trigram_list_t));
+    if (!grown)
+      return NULL;
+    for (size_t i = 0; i < trigrams_cap; i++)
+    {
+      if (!trigrams[i].trigram)
+        continue;
+      size_t j = hash_trigram(trigrams[i].trigram, new_cap);
+      while (grown[j].trigram)
+        j = (j + 1) & (new_cap - 1);
+      grown[j] = trigrams[i];
+    }
+    free(trigrams);
+    trigrams = grown;
+    trigrams_cap = new_cap;
+  }
+  size_t i = hash_trigram(trigram, trigrams_cap);
+  while (trigrams[i].trigram)
+    i = (i + 1) & (trigrams_cap - 1);
+  trigrams[i].trigram = trigram;
+  trigrams_count++;
+  return &trigrams[i];
+}
+
+static unsigned int trigram_at(const char *p)
+{
+  return (unsigned char)p[0] << 16 | (unsigned char)p[1] << 8 | (unsigned char)p[2];
+}
+
+/* Record every trigram of line as occurring in entry seq */
+static void index_entry(const char *line, unsigned int seq)
+{
+  size_t len = strlen(line);
+  for (size_t i = 0; i + 3 <= len; i++)
+  {
+    trigram_list_t *list = find_trigram(trigram_at(line + i), 1);
+    if (!list || (list->len && list->seqs[list->len - 1] == seq))
+      continue;
+    if (list->len == list->cap)
+    {
+      int cap = list->cap ? list->cap * 2 : 4;
+      unsigned int *grown = realloc(list->seqs, cap * sizeof(unsigned int));
+      if (!grown)
+        continue;
+      list->seqs = grown;
+      list->cap = cap;
+    }
+    list->seqs[list->len++] = seq;
+  }
+}
+
+/* Drop the index and build it again from the live entries */
+static void rebuild_index(void)
+{
+  for (size_t i = 0; i < trigrams_cap; i++)
+    free(trigrams[i].seqs);
+  free(trigrams);
+  trigrams = NULL;
+  trigrams_cap = trigrams_count = 0;
+  stale = 0;
+  for (int i = 0; i < count; i++)
+    index_entry(ring[start + i]->line, next_seq - count + i);
+}
 
-#define MAX_INPUT_SIZE 1024
-#define MAX_HISTORY 100
+/* Count evicted entries, rebuilding the index once they are as many as the slots */
+static void note_evicted(int n)
+{
+  stale += n;
+  if (stale > (unsigned int)capacity && stale > INDEX_MIN)
+    rebuild_index();
+}
+
+/* Give readline, if it is loaded, the live run of the ring as its history list */
+static void share_with_readline(void)
+{
+  if (!line_editor)
+    return;
+  HISTORY_STATE state = {0};
+  state.entries = count ? ring + start : NULL;
+  state.offset = state.length = state.size = count;
+  line_editor->set_history_state(&state);
+}
+
+/* Entries are allocated here, not by readline; any undo list in data is readline's */
+static void free_entry(HIST_ENTRY *entry)
+{
+  free(entry->line);
+  free(entry->timestamp);
+  free(entry);
+}
+
+/* Resize the ring to the current HISTSIZE, keeping the newest entries */
+static int resize_ring(int wanted)
+{
+  HIST_ENTRY **grown = NULL;
+  if (wanted > 0)
+  {
+    grown = malloc((2 * (size_t)wanted + 1) * sizeof(HIST_ENTRY *));
+    if (!grown)
+      return -1;
+  }
+  int keep = count < wanted ? count : wanted;
+  int evicted = count - keep;
+  for (int i = 0; i < evicted; i++)
+    free_entry(ring[start + i]);
+  if (keep)
+    memcpy(grown, ring + start + evicted, keep * sizeof(HIST_ENTRY *));
+  if (grown)
+    grown[keep] = NULL;
+  free(ring);
+  ring = grown;
+  capacity = wanted;
+  start = 0;
+  count = keep;
+  note_evicted(evicted);
+  return 0;
+}
 
-static char history[MAX_HISTORY][MAX_INPUT_SIZE];
-static int history_count = 0;
+/* Append len bytes of text as the newest entry */
+static void push_entry(const char *text, size_t len)
+{
+  HIST_ENTRY *entry = malloc(sizeof(HIST_ENTRY));
+  char *line = strndup(text, len);
+  char *timestamp = strdup(""); /* readline expects one */
+  if (!entry || !line || !timestamp)
+  {
+    free(entry);
+    free(line);
+    free(timestamp);
+    return;
+  }
+  entry->line = line;
+  entry->timestamp = timestamp;
+  entry->data = NULL;
+
+  int evicted = count == capacity;
+  if (evicted)
+  {
+    free_entry(ring[start]);
+    start++;
+    count--;
+  }
+  if (start + count == 2 * capacity)
+  {
+    memmove(ring, ring + start, count * sizeof(HIST_ENTRY *));
+    start = 0;
+  }
+  ring[start + count++] = entry;
+  ring[start + count] = NULL;
+  index_entry(line, next_seq++);
+  if (evicted)
+    note_evicted(1);
+}
+
+/*
+ * Lock the history file open on fd, then make sure it is still the one at path: a
+ * session trimming the file replaces it, and anything written to the old one is lost.
+ */
+static int lock_history_file(int fd, const char *path)
+{
+  while (flock(fd, LOCK_EX) == -1)
+  {
+    if (errno != EINTR)
+      return 1; /* no locking on this file system; do without */
+  }
+  struct stat held, current;
+  return fstat(fd, &held) == 0 && stat(path, &current) == 0 && held.st_dev == current.st_dev &&
+         held.st_ino == current.st_ino;
+}
+
+/* Open path for appending, locked; -1 on failure */
+static int open_history_file(const char *path)
+{
+  for (int tries = 0; tries < 5; tries++)
+  {
+    int fd = open(path, O_WRONLY | O_APPEND | O_CREAT | O_CLOEXEC, 0600);
+    if (fd == -1)
+      return -1;
+    if (lock_history_file(fd, path))
+      return fd;
+    close(fd);
+  }
+  return -1;
+}
+
+/*
+ * Replace the history file with its last lines: the kept part of the old mapping plus
+ * whatever other sessions appended since it was mapped. Done under the lock, through a
+ * temporary file renamed into place.
+ */
+static void trim_history_file(const char *path, const struct stat *mapped_st, const char *map,
+                              size_t keep_from)
+{
+  int fd = open_history_file(path);
+  if (fd == -1)
+    return;
+  size_t mapped = mapped_st->st_size;
+  struct stat st;
+  size_t tmp_len = strlen(path) + sizeof(".XXXXXX");
+  char *tmp = malloc(tmp_len);
+  int out = -1;
+  if (tmp && fstat(fd, &st) == 0 && st.st_ino == mapped_st->st_ino &&
+      st.st_dev == mapped_st->st_dev && (size_t)st.st_size >= mapped)
+  {
+    snprintf(tmp, tmp_len, "%s.XXXXXX", path);
+    out = mkostemp(tmp, O_CLOEXEC);
+  }
+  if (out != -1)
+  {
+    int ok = write(out, map + keep_from, mapped - keep_from) == (ssize_t)(mapped - keep_from);
+    int in = open(path, O_RDONLY | O_CLOEXEC);
+    char buf[8192];
+    ssize_t n;
+    off_t pos = mapped;
+    while (ok && in != -1 && (n = pread(in, buf, sizeof(buf), pos)) > 0)
+    {
+      ok = write(out, buf, n) == n;
+      pos += n;
+    }
+    if (in != -1)
+      close(in);
+    fchmod(out, st.st_mode & 0777);
+    if (close(out) == 0 && ok && in != -1)
+      rename(tmp, path);
+    else
+      unlink(tmp);
+  }
+  free(tmp);
+  close(fd);
+}
+
+/*
+ * Read the newest entries of the history file into the ring. The file is mapped and
+ * walked backwards from its end, so only the pages holding the lines kept are ever
+ * read in, however long it has grown. A file more than twice the size of that tail is
+ * trimmed down to it.
+ */
+static void load_history_file(const char *path)
+{
+  int fd = open(path, O_RDONLY | O_CLOEXEC);
+  if (fd == -1)
+    return;
+  struct stat st;
+  if (fstat(fd, &st) == -1 || st.st_size == 0)
+  {
+    close(fd);
+    return;
+  }
+  size_t size = st.st_size;
+  char *map = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (map == MAP_FAILED)
+    return;
+
+  const char *end = map + size;
+  const char *tail = end;
+  int lines = 0;
+  while (tail > map && lines < capacity)
+  {
+    const char *line_end = tail;
+    if (line_end[-1] == '\n')
+      line_end--;
+    const char *nl = memrchr(map, '\n', line_end - map);
+    const char *line = nl ? nl + 1 : map;
+    if (line < line_end)
+      lines++;
+    tail = line;
+  }
+
+  for (const char *p = tail; p < end;)
+  {
+    const char *nl = memchr(p, '\n', end - p);
+    const char *line_end = nl ? nl : end;
+    if (line_end > p)
+      push_entry(p, line_end - p);
+    p = nl ? nl + 1 : end;
+  }
+
+  if (tail - map > end - tail)
+    trim_history_file(path, &st, map, tail - map);
+  munmap(map, size);
+}
+
+void history_init(void)
+{
+  if (loaded)
+    return;
+  loaded = 1;
+  if (resize_ring(history_size_setting()) == -1)
+    return;
+  const char *path = history_file_path();
+  if (path && capacity)
+    load_history_file(path);
+  share_with_readline();
+}
+
+/* Append one line to the history file, under its lock so sessions never interleave */
+static void append_to_history_file(const char *command)
+{
+  const char *path = history_file_path();
+  if (!path)
+    return;
+  int fd = open_history_file(path);
+  if (fd == -1)
+    return;
+  struct iovec iov[2] = {{(void *)command, strlen(command)}, {"\n", 1}};
+  while (writev(fd, iov, 2) == -1 && errno == EINTR)
+  {
+  }
+  close(fd);
+}
 
 void add_to_history(const char *command)
 {
   if (!command || command[0] == '\0')
     return;
 
-  if (history_count == MAX_HISTORY)
+  history_init();
+  int wanted = history_size_setting();
+  if (wanted != capacity && resize_ring(wanted) == -1)
+    return;
+  if (capacity > 0)
+    push_entry(command, strlen(command));
+  share_with_readline();
+  if (capacity > 0)
+    append_to_history_file(command);
+}
+
+void show_history(void)
+{
+  for (int i = 0; i < count; i++)
   {
-    /* Shift entries up to make room */
-    for (int i = 1; i < MAX_HISTORY; i++)
+    printf("%d: %s\n", i + 1, ring[start + i]->line);
+  }
+}
+
+/*
+ * The longest run of pattern that must appear in a match as is: all of it for a plain
+ * substring, else the longest stretch free of glob operators and bracket expressions
+ */
+static size_t literal_part(const char *pattern, int glob, const char **lit)
+{
+  *lit = pattern;
+  if (!glob)
+    return strlen(pattern);
+  size_t best = 0;
+  const char *run = pattern;
+  for (const char *p = pattern;; p++)
+  {
+    if (*p && !strchr("*?[\\", *p))
+      continue;
+    if ((size_t)(p - run) > best)
     {
-      strcpy(history[i - 1], history[i]);
+      best = p - run;
+      *lit = run;
     }
-    history_count--;
+    if (!*p)
+      break;
+    if (*p == '\\' && p[1])
+      p++;
+    else if (*p == '[')
+    {
+      const char *close = p[1] ? strchr(p + 2, ']') : NULL;
+      if (close)
+        p = close;
+    }
+    run = p + 1;
   }
+  return best;
+}
 
-  strncpy(history[history_count], command, MAX_INPUT_SIZE - 1);
-  history[history_count][MAX_INPUT_SIZE - 1] = '\0';
-  history_count++;
+static int entry_matches(const char *line, const char *pattern, const char *wrapped)
+{
+  return wrapped ? fnmatch(wrapped, line, 0) == 0 : strstr(line, pattern) != NULL;
 }
 
-void show_history(void)
+int history_search(const char *pattern, int before)
 {
-  for (int i = 0; i < history_count; i++)
+  if (before > count)
+    before = count;
+  if (!*pattern || before <= 0)
+    return -1;
+
+  // A glob pattern matches anywhere in the entry, like a substring
+  char *wrapped = NULL;
+  int glob = strpbrk(pattern, "*?[") != NULL;
+  if (glob)
+  {
+    size_t len = strlen(pattern);
+    wrapped = malloc(len + 3);
+    if (!wrapped)
+      return -1;
+    wrapped[0] = '*';
+    memcpy(wrapped + 1, pattern, len);
+    strcpy(wrapped + 1 + len, "*");
+  }
+
+  int found = -1;
+  const char *lit;
+  size_t lit_len = literal_part(pattern, glob, &lit);
+  if (lit_len < 3)
+  {
+    // Too short to have a trigram: scan back from the newest
+    for (int pos = before - 1; pos >= 0 && found == -1; pos--)
+    {
+      if (entry_matches(ring[start + pos]->line, pattern, wrapped))
+        found = pos;
+    }
+    free(wrapped);
+    return found;
+  }
+
+  // Every match holds every trigram of the literal part: walk the shortest list
+  trigram_list_t *best = NULL;
+  for (size_t i = 0; i + 3 <= lit_len; i++)
+  {
+    trigram_list_t *list = find_trigram(trigram_at(lit + i), 0);
+    if (!list)
+    {
+      free(wrapped);
+      return -1;
+    }
+    if (!best || list->len < best->len)
+      best = list;
+  }
+  unsigned int oldest = next_seq - count;
+  unsigned int limit = oldest + before;
+  int lo = 0, hi = best->len; /* first entry numbered limit or later */
+  while (lo < hi)
+  {
+    int mid = (lo + hi) / 2;
+    if (best->seqs[mid] < limit)
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
+  for (int k = lo - 1; k >= 0 && best->seqs[k] >= oldest && found == -1; k--)
+  {
+    int pos = best->seqs[k] - oldest;
+    if (entry_matches(ring[start + pos]->line, pattern, wrapped))
+      found = pos;
+  }
+  free(wrapped);
+  return found;
+}
+
+const char *history_entry(int pos)
+{
+  return pos >= 0 && pos < count ? ring[start + pos]->line : NULL;
+}
+
+int show_history_matches(const char *pattern)
+{
+  int *found = NULL, n = 0;
+  for (int pos = history_search(pattern, count); pos != -1; pos = history_search(pattern, pos))
+  {
+    int *grown = realloc(found, (n + 1) * sizeof(int));
+    if (!grown)
+      break;
+    found = grown;
+    found[n++] = pos;
+  }
+  for (int i = n - 1; i >= 0; i--)
+    printf("%d: %s\n", found[i] + 1, ring[start + found[i]]->line);
+  free(found);
+  return n;
+}
+
+/* Show the search prompt with the line found (or the line as it was) after it */
+static void show_search(const char *query, int found, const char *original)
+{
+  const char *line = found == -1 ? original : ring[start + found]->line;
+  line_editor->replace_line(line, 0);
+  const char *at = found == -1 ? NULL : strstr(line, query);
+  *line_editor->point = at ? (int)(at - line) : 0;
+  line_editor->message("(%sreverse-i-search)`%s': ", found == -1 && *query ? "failing " : "",
+                       query);
+  line_editor->redisplay();
+}
+
+int history_reverse_search(int rl_count, int key)
+{
+  (void)rl_count;
+  (void)key;
+  char *original = strdup(*line_editor->line_buffer);
+  if (!original)
+    return 0;
+  char query[256] = "";
+  size_t len = 0;
+  int found = -1;
+  show_search(query, found, original);
+
+  for (;;)
   {
-    printf("%d: %s\n", i + 1, history[i]);
+    int c = line_editor->read_key();
+    if (c == CTRL('R'))
+    {
+      // Next older match
+      int pos = len ? history_search(query, found == -1 ? count : found) : -1;
+      if (pos != -1)
+        found = pos;
+    }
+    else if (c == CTRL('G'))
+    {
+      found = -1;
+      line_editor->replace_line(original, 0);
+      *line_editor->point = strlen(original);
+      break;
+    }
+    else if (c == 127 || c == CTRL('H'))
+    {
+      if (len)
+        query[--len] = '\0';
+      found = len ? history_search(query, count) : -1;
+    }
+    else if (isprint(c) && len + 1 < sizeof(query))
+    {
+      // The current match may still do; else look further back
+      query[len++] = c;
+      query[len] = '\0';
+      found = history_search(query, found == -1 ? count : found + 1);
+    }
+    else
+    {
+      // Any other key ends the search and then does what it always does
+      line_editor->execute_next(c);
+      break;
+    }
+    show_search(query, found, original);
   }
+  line_editor->clear_message();
+  free(original);
+  return 0;
 }
@@ -1,120 +1,267 @@
 #include "io.h"
+#include <ctype.h>
 #include <fcntl.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
 
-void handle_redirection(char **args, int *arg_count) {
-  int in_fd = -1, out_fd = -1;
-
-  for (int i = 0; i < *arg_count; i++) {
-    if (!args[i]) break;
+/*
+ * Recognise a redirection operator word as produced by the lexer: an optional
+ * descriptor number followed by one of < > >> >| <> <& >& << <<-. Returns 1 and fills
+ * *fd / *op, 0 for ordinary words.
+ */
+static int parse_operator(const char *w, int *fd, redir_op_t *op) {
+  const char *p = w;
+  int n = -1;
+  if (isdigit((unsigned char)*p)) {
+    n = 0;
+    while (isdigit((unsigned char)*p)) n = n * 10 + (*p++ - '0');
+  }
+  int out = *p == '>';
+  if (strcmp(p, "<") == 0) {
+    *op = REDIR_IN;
+  } else if (strcmp(p, ">") == 0 || strcmp(p, ">|") == 0) {
+    *op = REDIR_OUT;
+  } else if (strcmp(p, ">>") == 0) {
+    *op = REDIR_APPEND;
+  } else if (strcmp(p, "<>") == 0) {
+    *op = REDIR_RDWR;
+  } else if (strcmp(p, "<&") == 0 || strcmp(p, ">&") == 0) {
+    *op = REDIR_DUP;
+  } else if (strcmp(p, "<<") == 0 || strcmp(p, "<<-") == 0) {
+    *op = REDIR_HEREDOC;
+  } else {
+    return 0;
+  }
+  *fd = n >= 0 ? n : (out ? STDOUT_FILENO : STDIN_FILENO);
+  return 1;
+}
 
-    /* Input redirection */
-    if (strcmp(args[i], "<") == 0) {
-      if (!args[i + 1]) {
-        fprintf(stderr, "ash: missing filename after <\n");
-        exit(EXIT_FAILURE);
-      }
-      in_fd = open(args[i + 1], O_RDONLY);
-      if (in_fd == -1) {
-        perror("open");
-        exit(EXIT_FAILURE);
-      }
-      if (dup2(in_fd, STDIN_FILENO) == -1) {
-        perror("dup2");
-        exit(EXIT_FAILURE);
-      }
-      args[i] = NULL;
-      *arg_count = i;
-      break;
+int parse_redirections(char **args, int arg_count, redir_list_t *out) {
+  out->argv = malloc((arg_count + 1) * sizeof(char *));
+  out->items = malloc((arg_count / 2 + 1) * sizeof(redir_t));
+  out->argc = out->count = 0;
+  if (!out->argv || !out->items) {
+    perror("malloc");
+    free_redirections(out);
+    return -1;
+  }
+  for (int i = 0; i < arg_count && args[i]; i++) {
+    redir_t r;
+    if (!parse_operator(args[i], &r.fd, &r.op)) {
+      out->argv[out->argc++] = args[i];
+      continue;
     }
-    /* Output redirection overwrite */
-    else if (strcmp(args[i], ">") == 0) {
-      if (!args[i + 1]) {
-        fprintf(stderr, "ash: missing filename after >\n");
-        exit(EXIT_FAILURE);
-      }
-      out_fd = open(args[i + 1], O_WRONLY | O_CREAT | O_TRUNC, 0644);
-      if (out_fd == -1) {
-        perror("open");
-        exit(EXIT_FAILURE);
-      }
-      if (dup2(out_fd, STDOUT_FILENO) == -1) {
-        perror("dup2");
-        exit(EXIT_FAILURE);
-      }
-      args[i] = NULL;
-      *arg_count = i;
-      break;
+    if (i + 1 >= arg_count || !args[i + 1]) {
+      const char *what = r.op == REDIR_HEREDOC ? "delimiter" : "filename";
+      fprintf(stderr, "ash: missing %s after %s\n", what, args[i]);
+      free_redirections(out);
+      return -1;
     }
-    /* Output redirection append */
-    else if (strcmp(args[i], ">>") == 0) {
-      if (!args[i + 1]) {
-        fprintf(stderr, "ash: missing filename after >>\n");
-        exit(EXIT_FAILURE);
-      }
-      out_fd = open(args[i + 1], O_WRONLY | O_CREAT | O_APPEND, 0644);
-      if (out_fd == -1) {
-        perror("open");
-        exit(EXIT_FAILURE);
-      }
-      if (dup2(out_fd, STDOUT_FILENO) == -1) {
-        perror("dup2");
-        exit(EXIT_FAILURE);
-      }
-      args[i] = NULL;
-      *arg_count = i;
-      break;
-    } else if (strcmp(args[i], "<<") == 0) {
-      if (!args[i + 1]) {
-        fprintf(stderr, "ash: missing delimiter after <<\n");
-        exit(EXIT_FAILURE);
-      }
-      const char *delim = args[i + 1];
-      int pipefd[2];
-      if (pipe(pipefd) == -1) {
-        perror("pipe");
-        exit(EXIT_FAILURE);
-      }
-      /* Collect heredoc into write end */
-      FILE *w = fdopen(pipefd[1], "w");
-      if (!w) {
-        perror("fdopen");
-        exit(EXIT_FAILURE);
-      }
-      char *line = NULL;
-      size_t cap = 0;
-      while (1) {
-        if (isatty(STDIN_FILENO)) {
-          fputs("> ", stderr);
-          fflush(stderr);
-        }
-        ssize_t n = getline(&line, &cap, stdin);
-        if (n == -1) {
-          fprintf(stderr, "ash: unexpected EOF while looking for matching %s\n", delim);
-          exit(EXIT_FAILURE);
+    r.target = args[++i];
+    if (r.op == REDIR_DUP && strcmp(r.target, "-") == 0) {
+      r.op = REDIR_CLOSE;
+    } else if (r.op == REDIR_DUP) {
+      for (const char *t = r.target; *t; t++) {
+        if (!isdigit((unsigned char)*t)) {
+          fprintf(stderr, "ash: %s: bad file descriptor\n", r.target);
+          free_redirections(out);
+          return -1;
         }
-        /* Remove trailing newline for comparison */
-        if (n > 0 && line[n - 1] == '\n') line[n - 1] = '\0';
-        if (strcmp(line, delim) == 0) break;
-        /* Write line plus newline back */
-        fprintf(w, "%s\n", line);
-      }
-      free(line);
-      fclose(w); /* closes pipefd[1] */
-      if (dup2(pipefd[0], STDIN_FILENO) == -1) {
-        perror("dup2");
-        exit(EXIT_FAILURE);
       }
-      close(pipefd[0]);
-      args[i] = NULL;
-      *arg_count = i;
-      break;
     }
+    out->items[out->count++] = r;
   }
+  out->argv[out->argc] = NULL;
+  return 0;
+}
+
+void free_redirections(redir_list_t *r) {
+  free(r->argv);
+  free(r->items);
+  r->argv = NULL;
+  r->items = NULL;
+  r->argc = r->count = 0;
+}
+
+int redirections_need_stdin(const redir_list_t *r) {
+  for (int i = 0; i < r->count; i++)
+    if (r->items[i].op == REDIR_HEREDOC) return 1;
+  return 0;
+}
+
+static int open_target(const redir_t *r) {
+  switch (r->op) {
+    case REDIR_IN:
+      return open(r->target, O_RDONLY | O_CLOEXEC);
+    case REDIR_OUT:
+      return open(r->target, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    case REDIR_APPEND:
+      return open(r->target, O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+    case REDIR_RDWR:
+      return open(r->target, O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+    default:
+      return -1;
+  }
+}
+
+static int is_file_op(redir_op_t op) {
+  return op == REDIR_IN || op == REDIR_OUT || op == REDIR_APPEND || op == REDIR_RDWR;
+}
+
+int open_redirections(const redir_list_t *r, int *fds) {
+  for (int i = 0; i < r->count; i++) {
+    fds[i] = -1;
+    if (!is_file_op(r->items[i].op)) continue;
+    fds[i] = open_target(&r->items[i]);
+    if (fds[i] == -1) {
+      fprintf(stderr, "ash: ");
+      perror(r->items[i].target);
+      close_redirections(r, fds);
+      return -1;
+    }
+  }
+  return 0;
+}
 
-  if (in_fd != -1) close(in_fd);
-  if (out_fd != -1) close(out_fd);
+void close_redirections(const redir_list_t *r, int *fds) {
+  for (int i = 0; i < r->count; i++) {
+    if (fds[i] != -1) close(fds[i]);
+    fds[i] = -1;
+  }
+}
+
+int redirections_to_file_actions(const redir_list_t *r, const int *fds,
+                                 posix_spawn_file_actions_t *fa) {
+  for (int i = 0; i < r->count; i++) {
+    const redir_t *it = &r->items[i];
+    int rc = 0;
+    switch (it->op) {
+      case REDIR_DUP:
+        rc = posix_spawn_file_actions_adddup2(fa, atoi(it->target), it->fd);
+        break;
+      case REDIR_CLOSE:
+        rc = posix_spawn_file_actions_addclose(fa, it->fd);
+        break;
+      case REDIR_HEREDOC:
+        return -1;  // needs the fork path
+      default:
+        // POSIX clears close-on-exec when both descriptors are the same
+        rc = posix_spawn_file_actions_adddup2(fa, fds[i], it->fd);
+        break;
+    }
+    if (rc != 0) return -1;
+  }
+  return 0;
+}
+
+/* Feed a here-document typed on stdin into fd through a pipe */
+static int read_heredoc(const char *delim, int fd) {
+  int pipefd[2];
+  if (pipe(pipefd) == -1) {
+    perror("pipe");
+    return -1;
+  }
+  /* Collect heredoc into write end */
+  FILE *w = fdopen(pipefd[1], "w");
+  if (!w) {
+    perror("fdopen");
+    return -1;
+  }
+  char *line = NULL;
+  size_t cap = 0;
+  while (1) {
+    if (isatty(STDIN_FILENO)) {
+      fputs("> ", stderr);
+      fflush(stderr);
+    }
+    ssize_t n = getline(&line, &cap, stdin);
+    if (n == -1) {
+      fprintf(stderr, "ash: unexpected EOF while looking for matching %s\n", delim);
+      return -1;
+    }
+    /* Remove trailing newline for comparison */
+    if (n > 0 && line[n - 1] == '\n') line[n - 1] = '\0';
+    if (strcmp(line, delim) == 0) break;
+    /* Write line plus newline back */
+    fprintf(w, "%s\n", line);
+  }
+  free(line);
+  fclose(w); /* closes pipefd[1] */
+  if (dup2(pipefd[0], fd) == -1) {
+    perror("dup2");
+    return -1;
+  }
+  close(pipefd[0]);
+  return 0;
+}
+
+static int apply_redirection(const redir_t *r) {
+  if (r->op == REDIR_HEREDOC) return read_heredoc(r->target, r->fd);
+  if (r->op == REDIR_CLOSE) {
+    close(r->fd);
+    return 0;
+  }
+  if (r->op == REDIR_DUP) {
+    if (dup2(atoi(r->target), r->fd) == -1) {
+      fprintf(stderr, "ash: %s: ", r->target);
+      perror("dup2");
+      return -1;
+    }
+    return 0;
+  }
+  int fd = open_target(r);
+  if (fd == -1) {
+    fprintf(stderr, "ash: ");
+    perror(r->target);
+    return -1;
+  }
+  if (fd != r->fd) {
+    if (dup2(fd, r->fd) == -1) {
+      perror("dup2");
+      return -1;
+    }
+    close(fd);
+  } else {
+    fcntl(fd, F_SETFD, 0);
+  }
+  return 0;
+}
+
+int save_and_apply_redirections(const redir_list_t *r, int *saved) {
+  fflush(stdout);  // buffered output belongs to the old stdout
+  for (int i = 0; i < r->count; i++) {
+    saved[i] = fcntl(r->items[i].fd, F_DUPFD_CLOEXEC, 10);  // -1: the fd was closed
+    if (apply_redirection(&r->items[i]) == -1) {
+      restore_redirections(r, saved, i + 1);
+      return -1;
+    }
+  }
+  return 0;
+}
+
+void restore_redirections(const redir_list_t *r, int *saved, int count) {
+  fflush(stdout);
+  for (int i = count - 1; i >= 0; i--) {
+    if (saved[i] == -1) {
+      close(r->items[i].fd);
+    } else {
+      dup2(saved[i], r->items[i].fd);
+      close(saved[i]);
+    }
+  }
+}
+
+void handle_redirection(char **args, int *arg_count) {
+  redir_list_t r;
+  // _exit: a forked child must not flush or rewind stdio streams it shares with the shell
+  if (parse_redirections(args, *arg_count, &r) == -1) _exit(EXIT_FAILURE);
+  for (int i = 0; i < r.count; i++) {
+    if (apply_redirection(&r.items[i]) == -1) _exit(EXIT_FAILURE);
+  }
+  // Words are only ever dropped, so compacting in place is safe
+  for (int i = 0; i <= r.argc; i++) args[i] = r.argv[i];
+  *arg_count = r.argc;
+  free_redirections(&r);
 }
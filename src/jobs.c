@@ -1,124 +1,468 @@
 #include "jobs.h"
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
 #include <sys/wait.h>
 #include <signal.h>
 #include <errno.h>
+#include <poll.h>
+#include <sys/signalfd.h>
 
-// Our job table
-job_t jobs[MAX_JOBS];
+/*
+ * Job table indexed by job ID: job n is job_table[n] (slot 0 is unused), NULL when free.
+ * A new job takes the ID after the highest one in use, as in other shells, so adding,
+ * finding and removing a job are all O(1); the table doubles when that ID runs past it.
+ */
+static job_t **job_table = NULL;
+static int table_size = 0;
+static int highest_id = 0;
 int job_count = 0;
 
-// Initialize the job system
-void jobs_init(void) {
-  // Clear all job slots
-  for (int i = 0; i < MAX_JOBS; ++i) {
-    jobs[i].pid = -1;
-    jobs[i].pgid = -1;
-    jobs[i].job_id = -1;
-    jobs[i].running = 0;
-    jobs[i].foreground = 0;
-    jobs[i].notified = 0;
-    jobs[i].command[0] = '\0';
+static int current_id = 0;   // %+
+static int previous_id = 0;  // %-
+
+#define JOBS_MIN 32
+
+/*
+ * Every process of every job, by pid: open addressing with linear probing over a
+ * power-of-two table, removals done by shifting later entries back so no tombstones
+ * are left behind.
+ */
+typedef struct {
+  pid_t pid;  // 0 marks an empty slot
+  int job_id;
+} pid_entry_t;
+
+#define PID_TABLE_MIN 64
+
+static pid_entry_t *pid_table = NULL;
+static size_t pid_cap = 0;
+static size_t pid_count = 0;
+
+/*
+ * Child state changes arrive on a signalfd: SIGCHLD stays blocked in the shell (and is
+ * unblocked again before exec), so each change leaves the descriptor readable instead
+ * of interrupting whatever the shell is doing. Only job processes are reaped from it,
+ * each by pid, so commands the shell waits for directly keep their statuses.
+ */
+static int sigchld_fd = -1;
+
+static size_t hash_pid(pid_t pid) {
+  return ((unsigned int)pid * 2654435761u) & (pid_cap - 1);  // Knuth's multiplicative hash
+}
+
+static int grow_pid_table(void) {
+  size_t new_cap = pid_cap ? pid_cap * 2 : PID_TABLE_MIN;
+  pid_entry_t *new_table = calloc(new_cap, sizeof(pid_entry_t));
+  if (!new_table) return -1;
+  pid_entry_t *old = pid_table;
+  size_t old_cap = pid_cap;
+  pid_table = new_table;
+  pid_cap = new_cap;
+  for (size_t i = 0; i < old_cap; i++) {
+    if (!old[i].pid) continue;
+    size_t j = hash_pid(old[i].pid);
+    while (pid_table[j].pid) j = (j + 1) & (pid_cap - 1);
+    pid_table[j] = old[i];
   }
-  job_count = 0;
+  free(old);
+  return 0;
+}
+
+// Map pid to job_id; a reused pid now belongs to the newer job
+static int add_pid(pid_t pid, int job_id) {
+  if ((pid_count + 1) * 2 > pid_cap && grow_pid_table() == -1) return -1;
+  size_t i = hash_pid(pid);
+  while (pid_table[i].pid && pid_table[i].pid != pid) i = (i + 1) & (pid_cap - 1);
+  if (!pid_table[i].pid) pid_count++;
+  pid_table[i].pid = pid;
+  pid_table[i].job_id = job_id;
+  return 0;
 }
 
-// Find an empty slot in the job table
-static job_t *alloc_job_slot(void) {
-  for (int i = 0; i < MAX_JOBS; ++i) {
-    if (jobs[i].pid == -1) return &jobs[i];
+// Forget pid if it still belongs to job_id
+static void remove_pid(pid_t pid, int job_id) {
+  if (!pid_cap) return;
+  size_t i = hash_pid(pid);
+  while (pid_table[i].pid != pid) {
+    if (!pid_table[i].pid) return;
+    i = (i + 1) & (pid_cap - 1);
   }
-  return NULL;
+  if (pid_table[i].job_id != job_id) return;
+
+  // Close the gap: move back any later entry in the run that may not skip over it
+  size_t gap = i;
+  for (size_t j = (i + 1) & (pid_cap - 1); pid_table[j].pid; j = (j + 1) & (pid_cap - 1)) {
+    size_t home = hash_pid(pid_table[j].pid);
+    if (((j - home) & (pid_cap - 1)) >= ((j - gap) & (pid_cap - 1))) {
+      pid_table[gap] = pid_table[j];
+      gap = j;
+    }
+  }
+  pid_table[gap].pid = 0;
+  pid_count--;
+}
+
+// Initialize the job system
+void jobs_init(void) {
+  job_table = calloc(JOBS_MIN, sizeof(job_t *));
+  table_size = job_table ? JOBS_MIN : 0;
+  highest_id = job_count = 0;
+  current_id = previous_id = 0;
+
+  sigset_t chld;
+  sigemptyset(&chld);
+  sigaddset(&chld, SIGCHLD);
+  sigprocmask(SIG_BLOCK, &chld, NULL);
+  sigchld_fd = signalfd(-1, &chld, SFD_NONBLOCK | SFD_CLOEXEC);
+}
+
+// Make room for job ID id in the table
+static int reserve_job_id(int id) {
+  if (id < table_size) return 0;
+  int size = table_size ? table_size : JOBS_MIN;
+  while (size <= id) size *= 2;
+  job_t **grown = realloc(job_table, size * sizeof(job_t *));
+  if (!grown) return -1;
+  memset(grown + table_size, 0, (size - table_size) * sizeof(job_t *));
+  job_table = grown;
+  table_size = size;
+  return 0;
+}
+
+static void free_job(job_t *job) {
+  free(job->usage);
+  free(job->command);
+  free(job->pids);
+  free(job->status);
+  free(job);
 }
 
 // Add a new job to our table
-int add_job(pid_t pid, pid_t pgid, const char *command, int bg) {
-  // Find a free slot
-  job_t *slot = alloc_job_slot();
-  if (!slot) {
-    fprintf(stderr, "ash: too many jobs\n");
+int add_job(pid_t pgid, const pid_t *pids, int nprocs, const char *command, int bg) {
+  int id = highest_id + 1;  // Job IDs start at 1
+  job_t *job = calloc(1, sizeof(job_t));
+  if (!job || reserve_job_id(id) == -1) {
+    free(job);
+    fprintf(stderr, "ash: out of memory for jobs\n");
+    return -1;
+  }
+
+  // One pid and one status per process
+  job->pids = malloc(nprocs * sizeof(pid_t));
+  job->status = malloc(nprocs * sizeof(int));
+  job->usage = calloc(nprocs, sizeof(proc_usage_t));
+  job->command = strdup(command ? command : "");
+  if (!job->pids || !job->status || !job->usage || !job->command) {
+    free_job(job);
+    fprintf(stderr, "ash: out of memory\n");
     return -1;
   }
+  for (int i = 0; i < nprocs; i++) {
+    if (add_pid(pids[i], id) == -1) {
+      while (i-- > 0) remove_pid(pids[i], id);
+      free_job(job);
+      fprintf(stderr, "ash: out of memory\n");
+      return -1;
+    }
+    job->pids[i] = pids[i];
+    job->status[i] = -1;
+  }
+  job->nprocs = job->remaining = nprocs;
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  for (int i = 0; i < nprocs; i++) job->usage[i].start = now;
 
   // Fill in the details
-  int id = (slot - jobs) + 1;  // Job IDs start at 1
-  slot->pid = pid;
-  slot->pgid = pgid;
-  slot->job_id = id;
-  slot->running = 1;
-  slot->foreground = !bg;
-  slot->notified = 0;
-
-  // Copy the command string
-  strncpy(slot->command, command ? command : "", MAX_INPUT_SIZE - 1);
-  slot->command[MAX_INPUT_SIZE - 1] = '\0';
+  job->pid = pids[0];
+  job->pgid = pgid;
+  job->job_id = id;
+  job->running = 1;
+  job->foreground = !bg;
+  job->notified = 0;
 
+  job_table[id] = job;
+  highest_id = id;
   job_count++;
+  set_current_job(job);
   return id;
 }
 
+// Most recent job other than the current one, for %- when the old one goes away
+static int latest_other_job(void) {
+  for (int id = highest_id; id > 0; id--)
+    if (job_table[id] && id != current_id) return id;
+  return 0;
+}
+
 // Remove a job from our table
 void remove_job(int job_id) {
-  // Sanity checks
-  if (job_id <= 0 || job_id > MAX_JOBS) return;
-
-  job_t *j = &jobs[job_id - 1];
-  if (j->pid == -1)  // Already removed
+  job_t *job = find_job(job_id);
+  if (!job)  // Already removed
     return;
 
-  // Clear the slot
-  j->pid = j->pgid = -1;
-  j->job_id = -1;
-  j->running = j->foreground = j->notified = 0;
-  j->command[0] = '\0';
+  for (int i = 0; i < job->nprocs; i++) remove_pid(job->pids[i], job_id);
+  free_job(job);
+  job_table[job_id] = NULL;
   job_count--;
+  while (highest_id > 0 && !job_table[highest_id]) highest_id--;
+
+  if (job_id == current_id) {
+    current_id = previous_id;
+    previous_id = latest_other_job();
+  } else if (job_id == previous_id) {
+    previous_id = latest_other_job();
+  }
+}
+
+void set_current_job(job_t *job) {
+  if (job->job_id == current_id) return;
+  previous_id = current_id;
+  current_id = job->job_id;
+}
+
+job_t *find_job(int job_id) {
+  if (job_id <= 0 || job_id > highest_id) return NULL;
+  return job_table[job_id];
 }
 
-// Find a job by its process ID
 job_t *find_job_by_pid(pid_t pid) {
-  for (int i = 0; i < MAX_JOBS; ++i) {
-    if (jobs[i].pid == pid) return &jobs[i];
-  }
+  if (pid <= 0 || !pid_cap) return NULL;
+  for (size_t i = hash_pid(pid); pid_table[i].pid; i = (i + 1) & (pid_cap - 1))
+    if (pid_table[i].pid == pid) return find_job(pid_table[i].job_id);
+  return NULL;
+}
+
+job_t *next_job(const job_t *job) {
+  for (int id = job ? job->job_id + 1 : 1; id <= highest_id; id++)
+    if (job_table[id]) return job_table[id];
   return NULL;
 }
 
-// Print the job list for the 'jobs' command
-void list_jobs(void) {
-  for (int i = 0; i < MAX_JOBS; ++i) {
-    if (jobs[i].pid == -1)  // Skip empty slots
-      continue;
+job_t *find_job_spec(const char *spec) {
+  if (spec[0] != '%') return NULL;
+  spec++;
+  if (!*spec || strcmp(spec, "%") == 0 || strcmp(spec, "+") == 0) return find_job(current_id);
+  if (strcmp(spec, "-") == 0) return find_job(previous_id);
+
+  char *end;
+  long n = strtol(spec, &end, 10);
+  if (end != spec && !*end) return n > 0 && n <= highest_id ? find_job((int)n) : NULL;
 
-    const char *status = jobs[i].running ? "Running" : "Stopped";
-    printf("[%d] %d %s\t%s\n", jobs[i].job_id, jobs[i].pid, status, jobs[i].command);
+  // %?string anywhere in the command, %string at its start; must name a single job
+  int anywhere = spec[0] == '?';
+  const char *text = spec + anywhere;
+  size_t len = strlen(text);
+  job_t *found = NULL;
+  for (job_t *job = next_job(NULL); job; job = next_job(job)) {
+    int match = anywhere ? strstr(job->command, text) != NULL
+                         : strncmp(job->command, text, len) == 0;
+    if (!match) continue;
+    if (found) return NULL;
+    found = job;
   }
+  return found;
 }
 
-// Check if any background jobs have finished
-void check_background_jobs(void) {
-  pid_t pid;
+int job_exit_status(const job_t *job) {
+  return wait_exit_code(job->status[job->nprocs - 1]);
+}
+
+int wait_exit_code(int wstatus) {
+  if (WIFSIGNALED(wstatus)) return 128 + WTERMSIG(wstatus);
+  return WEXITSTATUS(wstatus);
+}
+
+// Record how one of the job's processes ended
+int job_process_done(job_t *job, pid_t pid, int wstatus) {
+  for (int k = 0; k < job->nprocs; k++) {
+    if (job->pids[k] == pid && job->status[k] == -1) {
+      job->status[k] = wstatus;
+      job->remaining--;
+      break;
+    }
+  }
+  return job->remaining == 0;
+}
+
+static double seconds_between(struct timespec from, struct timespec to) {
+  return (to.tv_sec - from.tv_sec) + (to.tv_nsec - from.tv_nsec) / 1e9;
+}
+
+static double timeval_seconds(struct timeval tv) {
+  return tv.tv_sec + tv.tv_usec / 1e6;
+}
+
+void format_duration(char *buf, size_t size, double seconds) {
+  long minutes = (long)(seconds / 60);
+  snprintf(buf, size, "%ldm%.3fs", minutes, seconds - minutes * 60.0);
+}
+
+// How a process ended, as jobs shows it: Done, Exit N or the name of the signal
+static void describe_exit(int wstatus, char *buf, size_t size) {
+  if (WIFSIGNALED(wstatus))
+    snprintf(buf, size, "%s", strsignal(WTERMSIG(wstatus)));
+  else if (WEXITSTATUS(wstatus) == 0)
+    snprintf(buf, size, "Done");
+  else
+    snprintf(buf, size, "Exit %d", WEXITSTATUS(wstatus));
+}
+
+// One line for process k of a job: state, elapsed time and, once finished, its rusage
+static void list_process(const job_t *job, int k) {
+  const proc_usage_t *u = &job->usage[k];
+  char state[32], real[32], user[32], sys[32];
+  if (job->status[k] == -1) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    snprintf(state, sizeof(state), "%s", job->running ? "Running" : "Stopped");
+    format_duration(real, sizeof(real), seconds_between(u->start, now));
+    printf("      %d %-8s real %s\n", job->pids[k], state, real);
+    return;
+  }
+  describe_exit(job->status[k], state, sizeof(state));
+  format_duration(real, sizeof(real), seconds_between(u->start, u->end));
+  format_duration(user, sizeof(user), timeval_seconds(u->usage.ru_utime));
+  format_duration(sys, sizeof(sys), timeval_seconds(u->usage.ru_stime));
+  printf("      %d %-8s real %s user %s sys %s maxrss %ldK csw %ld/%ld\n", job->pids[k], state,
+         real, user, sys, u->usage.ru_maxrss, u->usage.ru_nvcsw, u->usage.ru_nivcsw);
+}
+
+// Print the job list for the 'jobs' command, marking the current (+) and previous (-) jobs
+void list_jobs(int long_format) {
+  for (job_t *job = next_job(NULL); job; job = next_job(job)) {
+    char status[32];
+    if (job->remaining == 0)
+      describe_exit(job->status[job->nprocs - 1], status, sizeof(status));
+    else
+      snprintf(status, sizeof(status), "%s", job->running ? "Running" : "Stopped");
+    char mark = job->job_id == current_id ? '+' : job->job_id == previous_id ? '-' : ' ';
+    printf("[%d]%c %d %s\t%s\n", job->job_id, mark, job->pid, status, job->command);
+    if (long_format)
+      for (int k = 0; k < job->nprocs; k++) list_process(job, k);
+  }
+}
+
+int jobs_event_fd(void) {
+  return sigchld_fd;
+}
+
+static long child_peak_rss;  // see take_child_peak_rss()
+
+void note_child_usage(const struct rusage *usage) {
+  if (usage->ru_maxrss > child_peak_rss) child_peak_rss = usage->ru_maxrss;
+}
+
+long take_child_peak_rss(void) {
+  long peak = child_peak_rss;
+  child_peak_rss = 0;
+  return peak;
+}
+
+// Collect the state change of job process k, if it has one; returns 1 if it did
+static int reap_process(job_t *job, int k) {
   int status;
+  struct rusage usage;
+  pid_t pid;
+  while ((pid = wait4(job->pids[k], &status, WNOHANG | WUNTRACED, &usage)) == -1 &&
+         errno == EINTR) {
+  }
+  if (pid == 0) return 0;
+  if (pid == -1) {
+    status = 0;  // reaped by someone else; count it as finished
+    memset(&usage, 0, sizeof(usage));
+  }
+  if (WIFSTOPPED(status)) {
+    // Process was stopped (Ctrl+Z)
+    job->running = 0;
+    job->notified = 0;
+    set_current_job(job);
+    return 1;
+  }
 
-  // Non-blocking check for any child process status changes
-  while ((pid = waitpid(-1, &status, WNOHANG | WUNTRACED)) > 0) {
-    job_t *job = find_job_by_pid(pid);
-    if (!job) continue;
+  clock_gettime(CLOCK_MONOTONIC, &job->usage[k].end);
+  job->usage[k].usage = usage;
+  note_child_usage(&usage);
+  if (job_process_done(job, job->pids[k], status))
+    job->notified = 0;  // finishing is news even if stopping was already reported
+  return 1;
+}
 
-    if (WIFSTOPPED(status)) {
-      // Process was stopped (Ctrl+Z)
-      job->running = 0;
-      if (!job->notified) {
-        printf("\n[%d] Stopped: %s\n", job->job_id, job->command);
-        job->notified = 1;
-      }
-    } else if (WIFEXITED(status) || WIFSIGNALED(status)) {
+// Try every live job process: used when a child outside the job table is waiting too
+static int reap_all_jobs(void) {
+  int changed = 0;
+  for (job_t *job = next_job(NULL); job; job = next_job(job))
+    for (int k = 0; k < job->nprocs; k++)
+      if (job->status[k] == -1) changed += reap_process(job, k);
+  return changed;
+}
+
+// Reap every job process whose state changed
+int reap_jobs(void) {
+  // Drain first: a change after this point leaves the descriptor readable again
+  struct signalfd_siginfo info;
+  while (sigchld_fd != -1 && read(sigchld_fd, &info, sizeof(info)) > 0) {
+  }
+
+  /*
+   * Ask the kernel which child has something to report, without collecting it, and
+   * look that pid up: the work is per event rather than per job process. A child that
+   * is not a job's (one the shell is about to wait for itself) would keep coming back
+   * first, so then fall back to trying each job process by pid.
+   */
+  int changed = 0;
+  for (;;) {
+    siginfo_t child;
+    child.si_pid = 0;
+    if (waitid(P_ALL, 0, &child, WEXITED | WSTOPPED | WNOHANG | WNOWAIT) == -1) {
+      if (errno == EINTR) continue;
+      break;
+    }
+    if (child.si_pid == 0) break;
+
+    job_t *job = find_job_by_pid(child.si_pid);
+    int k = 0;
+    while (job && job->pids[k] != child.si_pid) k++;
+    if (!job || job->status[k] != -1 || !reap_process(job, k))
+      return changed + reap_all_jobs();
+    changed++;
+  }
+  return changed;
+}
+
+int wait_for_job_event(int timeout_ms) {
+  if (sigchld_fd != -1) {
+    struct pollfd pfd = {sigchld_fd, POLLIN, 0};
+    while (poll(&pfd, 1, timeout_ms) == -1 && errno == EINTR) {
+    }
+  } else {
+    poll(NULL, 0, timeout_ms < 0 || timeout_ms > 10 ? 10 : timeout_ms);  // no signalfd
+  }
+  return reap_jobs();
+}
+
+// Report (and forget) background jobs that finished, and newly stopped ones
+int check_background_jobs(void) {
+  int reported = 0;
+  reap_jobs();
+  job_t *next;
+  for (job_t *job = next_job(NULL); job; job = next) {
+    next = next_job(job);
+    if (job->remaining == 0) {
       // Process finished or was killed
       if (!job->notified) {
-        printf("\n[%d] Done: %s\n", job->job_id, job->command);
-        job->notified = 1;
+        char status[32];
+        describe_exit(job->status[job->nprocs - 1], status, sizeof(status));
+        printf("\n[%d] %s: %s\n", job->job_id, status, job->command);
+        reported++;
       }
       remove_job(job->job_id);
+    } else if (!job->running && !job->notified) {
+      printf("\n[%d] Stopped: %s\n", job->job_id, job->command);
+      job->notified = 1;
+      reported++;
     }
   }
+  return reported;
 }
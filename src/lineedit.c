@@ -0,0 +1,50 @@
+#include "lineedit.h"
+
+#include <dlfcn.h>
+
+const line_editor_t *line_editor;
+
+static line_editor_t editor;
+
+int load_line_editor(void) {
+  if (line_editor) return 0;
+
+  void *lib = dlopen("libreadline.so.8", RTLD_LAZY);
+  if (!lib) lib = dlopen("libreadline.so", RTLD_LAZY);
+  if (!lib) {
+    fprintf(stderr, "ash: %s; line editing disabled\n", dlerror());
+    return -1;
+  }
+
+  const struct {
+    const char *name;
+    void **slot;
+  } symbols[] = {
+      {"readline", (void **)&editor.readline},
+      {"rl_initialize", (void **)&editor.initialize},
+      {"rl_bind_key", (void **)&editor.bind_key},
+      {"rl_complete", (void **)&editor.complete},
+      {"rl_getc", (void **)&editor.getc},
+      {"rl_on_new_line", (void **)&editor.on_new_line},
+      {"rl_redisplay", (void **)&editor.redisplay},
+      {"rl_replace_line", (void **)&editor.replace_line},
+      {"rl_message", (void **)&editor.message},
+      {"rl_clear_message", (void **)&editor.clear_message},
+      {"rl_read_key", (void **)&editor.read_key},
+      {"rl_execute_next", (void **)&editor.execute_next},
+      {"history_set_history_state", (void **)&editor.set_history_state},
+      {"rl_point", (void **)&editor.point},
+      {"rl_line_buffer", (void **)&editor.line_buffer},
+      {"rl_getc_function", (void **)&editor.getc_function},
+  };
+  for (size_t i = 0; i < sizeof(symbols) / sizeof(symbols[0]); i++) {
+    *symbols[i].slot = dlsym(lib, symbols[i].name);
+    if (!*symbols[i].slot) {
+      fprintf(stderr, "ash: readline: no %s; line editing disabled\n", symbols[i].name);
+      dlclose(lib);
+      return -1;
+    }
+  }
+  line_editor = &editor;
+  return 0;
+}
@@ -0,0 +1,26 @@
+#include "options.h"
+
+#include <stdio.h>
+#include <string.h>
+
+int shell_options[OPT_COUNT];
+
+static const char *option_names[OPT_COUNT] = {
+    [OPT_LASTPIPE] = "lastpipe",
+    [OPT_PIPEFAIL] = "pipefail",
+};
+
+int set_shell_option(const char *name, int on) {
+  for (int i = 0; i < OPT_COUNT; i++) {
+    if (strcmp(option_names[i], name) == 0) {
+      shell_options[i] = on;
+      return 0;
+    }
+  }
+  return -1;
+}
+
+void print_shell_options(void) {
+  for (int i = 0; i < OPT_COUNT; i++)
+    printf("%-15s %s\n", option_names[i], shell_options[i] ? "on" : "off");
+}
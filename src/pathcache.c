@@ -0,0 +1,190 @@
+#include "pathcache.h"
+
+#include <errno.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+extern char **environ;
+
+/*
+ * Open-addressing hash table (linear probing, power-of-two size) from command name to
+ * resolved path. The PATH it was built from is kept alongside; when the environment's
+ * PATH no longer matches, the whole table is dropped.
+ */
+typedef struct {
+  char *name;  // NULL marks an empty slot
+  char *path;
+  unsigned int hash;
+  unsigned long hits;
+} cmd_entry_t;
+
+#define CMD_TABLE_MIN 32
+
+static cmd_entry_t *cmds;
+static size_t cmds_cap;
+static size_t cmds_count;
+static char *cached_path_var;  // PATH the entries were resolved against
+
+static unsigned int hash_cmd(const char *name) {
+  unsigned int h = 2166136261u;  // FNV-1a
+  for (const unsigned char *p = (const unsigned char *)name; *p; p++) {
+    h ^= *p;
+    h *= 16777619u;
+  }
+  return h;
+}
+
+void clear_command_paths(void) {
+  for (size_t i = 0; i < cmds_cap; i++) {
+    free(cmds[i].name);
+    free(cmds[i].path);
+  }
+  free(cmds);
+  cmds = NULL;
+  cmds_cap = cmds_count = 0;
+  free(cached_path_var);
+  cached_path_var = NULL;
+}
+
+static void grow_cmds(void) {
+  size_t new_cap = cmds_cap ? cmds_cap * 2 : CMD_TABLE_MIN;
+  cmd_entry_t *new_cmds = calloc(new_cap, sizeof(cmd_entry_t));
+  if (!new_cmds) {
+    perror("calloc");
+    exit(EXIT_FAILURE);
+  }
+  for (size_t i = 0; i < cmds_cap; i++) {
+    if (!cmds[i].name) continue;
+    size_t j = cmds[i].hash & (new_cap - 1);
+    while (new_cmds[j].name) j = (j + 1) & (new_cap - 1);
+    new_cmds[j] = cmds[i];
+  }
+  free(cmds);
+  cmds = new_cmds;
+  cmds_cap = new_cap;
+}
+
+/*
+ * Walk PATH for name. *cacheable is cleared when the hit came from a relative directory
+ * (".", or an empty entry) since that answer changes with the working directory.
+ */
+static char *search_path(const char *name, const char *path_var, int *cacheable) {
+  size_t name_len = strlen(name);
+  const char *dir = path_var;
+  *cacheable = 1;
+  for (;;) {
+    const char *end = strchr(dir, ':');
+    size_t dir_len = end ? (size_t)(end - dir) : strlen(dir);
+    char *full = malloc(dir_len + name_len + 3);
+    if (!full) return NULL;
+    if (dir_len == 0) {
+      memcpy(full, "./", 2);
+      dir_len = 2;
+    } else {
+      memcpy(full, dir, dir_len);
+      full[dir_len++] = '/';
+    }
+    memcpy(full + dir_len, name, name_len + 1);
+
+    struct stat st;
+    if (stat(full, &st) == 0 && S_ISREG(st.st_mode) && access(full, X_OK) == 0) {
+      if (full[0] != '/') *cacheable = 0;
+      return full;
+    }
+    free(full);
+    if (!end) return NULL;
+    dir = end + 1;
+  }
+}
+
+/* Look name up; a rehash searches PATH again even if it is known, and counts no hit */
+static const char *resolve_command(const char *name, int rehash) {
+  if (strchr(name, '/')) return name;
+
+  const char *path_var = getenv("PATH");
+  if (!path_var) path_var = "/usr/local/bin:/usr/bin:/bin";
+  if (cached_path_var && strcmp(cached_path_var, path_var) != 0) clear_command_paths();
+
+  unsigned int h = hash_cmd(name);
+  cmd_entry_t *known = NULL;
+  if (cmds_cap) {
+    size_t i = h & (cmds_cap - 1);
+    while (cmds[i].name) {
+      if (cmds[i].hash == h && strcmp(cmds[i].name, name) == 0) {
+        known = &cmds[i];
+        break;
+      }
+      i = (i + 1) & (cmds_cap - 1);
+    }
+  }
+  if (known && !rehash) {
+    known->hits++;
+    return known->path;
+  }
+
+  int cacheable;
+  char *full = search_path(name, path_var, &cacheable);
+  if (!full) return NULL;
+  if (known && cacheable) {
+    free(known->path);
+    known->path = full;
+    known->hits = 0;
+    return full;
+  }
+  if (!cacheable) {
+    // Relative hits are re-resolved every time; keep the last one alive for the caller
+    static char *uncached;
+    free(uncached);
+    uncached = full;
+    return full;
+  }
+
+  if (!cached_path_var) cached_path_var = strdup(path_var);
+  if ((cmds_count + 1) * 10 > cmds_cap * 7) grow_cmds();
+  size_t i = h & (cmds_cap - 1);
+  while (cmds[i].name) i = (i + 1) & (cmds_cap - 1);
+  cmds[i].name = strdup(name);
+  cmds[i].path = full;
+  cmds[i].hash = h;
+  cmds[i].hits = !rehash;
+  cmds_count++;
+  return full;
+}
+
+const char *lookup_command_path(const char *name) {
+  return resolve_command(name, 0);
+}
+
+const char *hash_command_path(const char *name) {
+  return resolve_command(name, 1);
+}
+
+void exec_command_path(const char *path, char **args) {
+  // The shell keeps SIGCHLD blocked for its signalfd (see jobs.c); programs must not
+  // inherit that
+  sigset_t chld;
+  sigemptyset(&chld);
+  sigaddset(&chld, SIGCHLD);
+  sigprocmask(SIG_UNBLOCK, &chld, NULL);
+
+  if (path) {
+    execve(path, args, environ);
+    if (errno != ENOENT && errno != ENOEXEC) return;
+  }
+  execvp(args[0], args);
+}
+
+void list_command_paths(void) {
+  if (cmds_count == 0) {
+    printf("hash: hash table empty\n");
+    return;
+  }
+  printf("hits\tcommand\n");
+  for (size_t i = 0; i < cmds_cap; i++) {
+    if (cmds[i].name) printf("%4lu\t%s\n", cmds[i].hits, cmds[i].path);
+  }
+}
@@ -12,6 +12,8 @@
  */
 /* ash - minimal Unix-like shell */
 
+#define _GNU_SOURCE /* memfd_create, pipe2, F_SETPIPE_SZ */
+
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -21,12 +23,14 @@
 #include <fcntl.h>
 #include <signal.h>
 #include <errno.h>
-#include <readline/readline.h>
-#include <readline/history.h>
+#include <limits.h>
 #include <dirent.h>
 #include <termios.h>   /* Terminal control */
 #include <sys/ioctl.h> /* ioctl for terminal control */
 #include <ctype.h>
+#include <sys/mman.h>
+#include <spawn.h>
+#include <poll.h>
 #include "vars.h"
 #include "shell.h"
 #include "parser.h"
@@ -34,10 +38,14 @@
 #include "builtins.h"
 #include "history.h"
 #include "jobs.h"
+#include "lineedit.h"
 #include "terminal.h"
 #include "io.h"
+#include "options.h"
 #include "globbing.h"
 #include "alias.h"
+#include "pathcache.h"
+#include "testcmd.h"
 
 #define MAX_INPUT_SIZE 1024
 #define MAX_ARGS 64
@@ -48,17 +56,16 @@
 // Last command exit status (0 = success)
 int last_status = 0;
 
+extern char **environ;
+
 // Function declarations
 void print_prompt();
 char *read_input();
 char **parse_input(char *input, int *arg_count);
 int execute_command(char **args, int arg_count, int background);
-int execute_builtin(char **args);
 void add_to_history(const char *command);
 void show_history();
-void check_background_jobs();
 int parse_and_execute(char *input);
-void execute_with_pipe(char *cmd1, char *cmd2);
 /* redirection helpers in io.h */
 void initialize_readline();
 
@@ -70,41 +77,54 @@ void wait_for_job(job_t *job);
 void mark_job_as_running(job_t *job);
 void continue_job(job_t *job, int foreground);
 
-// Helper: trim leading and trailing whitespace in place
-static char *trim(char *s) {
-  while (*s && (*s == ' ' || *s == '\t')) s++;
-  char *end = s + strlen(s);
-  while (end > s && (*(end - 1) == ' ' || *(end - 1) == '\t')) *(--end) = '\0';
-  return s;
-}
-
-// after trim helper
-static char *find_logic_op(char *s, int *is_and) {
-  enum { NORM, SQ, DQ } st = NORM;
-  for (char *p = s; *p; p++) {
-    if (st == NORM) {
-      if (*p == '\'')
-        st = SQ;
-      else if (*p == '"')
-        st = DQ;
-      else if (*p == '&' && *(p + 1) == '&') {
-        *is_and = 1;
-        return p;
-      } else if (*p == '|' && *(p + 1) == '|') {
-        *is_and = 0;
-        return p;
-      } else if (*p == '\\')
-        p++;  // skip escaped char
-    } else if (st == SQ) {
-      if (*p == '\'') st = NORM;
-    } else if (st == DQ) {
-      if (*p == '"')
-        st = NORM;
-      else if (*p == '\\' && *(p + 1))
-        p++;
-    }
+/*
+ * --startup-profile: how long each start-up phase took, printed on stderr once an
+ * interactive shell is ready for input, or a -c command or script has run
+ */
+#define MAX_PHASES 8
+
+static struct {
+  const char *name;
+  double ms;
+} phases[MAX_PHASES];
+static int phase_count = -1;  // -1: not profiling
+static struct timespec phase_start;
+static pid_t profile_pid;  // forked children (subshells that exit) do not report
+
+/* End the current phase, naming it */
+static void profile_phase(const char *name) {
+  if (phase_count < 0) return;
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  if (phase_count < MAX_PHASES) {
+    phases[phase_count].name = name;
+    phases[phase_count].ms =
+        (now.tv_sec - phase_start.tv_sec) * 1e3 + (now.tv_nsec - phase_start.tv_nsec) / 1e6;
+    phase_count++;
   }
-  return NULL;
+  phase_start = now;
+}
+
+static void profile_report(void) {
+  if (phase_count < 0) return;
+  double total = 0;
+  fprintf(stderr, "ash: startup profile\n");
+  for (int i = 0; i < phase_count; i++) {
+    fprintf(stderr, "  %-16s %8.3f ms\n", phases[i].name, phases[i].ms);
+    total += phases[i].ms;
+  }
+  struct rusage usage;
+  getrusage(RUSAGE_SELF, &usage);
+  fprintf(stderr, "  %-16s %8.3f ms\n", "total (in main)", total);
+  fprintf(stderr, "  %-16s %8ld\n", "page faults", usage.ru_minflt + usage.ru_majflt);
+  fprintf(stderr, "  %-16s %8ld KB\n", "max RSS", usage.ru_maxrss);
+  phase_count = -1;  // printed once
+}
+
+void profile_finish(void) {
+  if (getpid() != profile_pid) return;
+  profile_phase("run");
+  profile_report();
 }
 
 /**
@@ -113,35 +133,29 @@ static char *find_logic_op(char *s, int *is_and) {
 int main(int argc, char *argv[]) {
   char *input;
 
+  if (argc > 1 && strcmp(argv[1], "--startup-profile") == 0) {
+    clock_gettime(CLOCK_MONOTONIC, &phase_start);
+    phase_count = 0;
+    profile_pid = getpid();
+    argv[1] = argv[0];
+    argc--;
+    argv++;
+  }
+
   // Set up our job system
   jobs_init();
+  profile_phase("jobs_init");
 
-  /* Handle -c option for one-liners */
+  /* Handle -c option for one-liners: no terminal or line editing to set up */
   if (argc > 1 && strcmp(argv[1], "-c") == 0) {
     if (argc < 3) {
       fprintf(stderr, "ash: -c requires an argument\n");
       return 1;
     }
 
-    /* Copy command and convert semicolons to newlines */
-    size_t len_cmd = strlen(argv[2]);
-    char *script = malloc(len_cmd + 2);
-    for (size_t i = 0; i < len_cmd; i++) {
-      script[i] = (argv[2][i] == ';') ? '\n' : argv[2][i];
-    }
-    script[len_cmd] = '\n';
-    script[len_cmd + 1] = '\0';
-
-    FILE *fp = fmemopen(script, len_cmd + 1, "r");
-    if (!fp) {
-      perror("fmemopen");
-      free(script);
-      return 1;
-    }
-    parse_stream(fp);
-    fclose(fp);
-    free(script);
-    return 0;
+    int status = parse_and_execute(argv[2]);
+    profile_finish();
+    return status;
   }
 
   /* Script execution mode */
@@ -159,15 +173,25 @@ int main(int argc, char *argv[]) {
       set_var(num, argv[i]);
     }
 
-    parse_stream(fp);
+    profile_phase("open script");
+    int status = parse_stream(fp);
     fclose(fp);
-    return 0;
+    profile_finish();
+    return status;
   }
 
   // Set up terminal and job control
   terminal_init();
   terminal_install_signal_handlers();
-  initialize_readline();
+  profile_phase("terminal_init");
+  if (load_line_editor() == 0) {
+    profile_phase("load readline");
+    initialize_readline();
+    profile_phase("readline init");
+  }
+  history_init();
+  profile_phase("history_init");
+  profile_report();
 
   // Main loop - read, parse, execute
   while (1) {
@@ -223,7 +247,22 @@ char *read_input() {
     strcpy(prompt, "ash> ");
   }
 
-  char *input = readline(prompt);
+  char *input = NULL;
+  if (line_editor) {
+    input = line_editor->readline(prompt);
+  } else {
+    // No readline: a plain prompt and line
+    size_t size = 0;
+    fputs(prompt, stdout);
+    fflush(stdout);
+    ssize_t len = getline(&input, &size, stdin);
+    if (len == -1) {
+      free(input);
+      input = NULL;
+    } else if (len > 0 && input[len - 1] == '\n') {
+      input[len - 1] = '\0';
+    }
+  }
 
   // Handle Ctrl+D (EOF)
   if (input == NULL) {
@@ -231,11 +270,6 @@ char *read_input() {
     exit(EXIT_SUCCESS);
   }
 
-  // Add to readline history if not empty
-  if (input[0] != '\0') {
-    add_history(input);
-  }
-
   return input;
 }
 
@@ -271,77 +305,172 @@ char **parse_input(char *input, int *arg_count) {
 }
 
 /**
- * Handle built-in commands
+ * Run a built-in in the current process and record its status
  */
-int execute_builtin(char **args) {
-  if (args[0] == NULL) {
-    return 1;
+static int run_builtin(const builtin_t *builtin, char **args) {
+  if ((builtin->flags & BUILTIN_TERMINAL) && !shell_is_interactive) {
+    fprintf(stderr, "ash: %s: no job control\n", builtin->name);
+    last_status = 1;
+  } else {
+    last_status = builtin->run(args);
   }
+  return last_status;
+}
 
-  // Try the simple built-ins first
-  if (handle_simple_builtin(args)) {
-    return 1;
-  }
+/* glibc can hand the terminal to a spawned process group itself */
+#if defined(__GLIBC__) && (__GLIBC__ > 2 || (__GLIBC__ == 2 && __GLIBC_MINOR__ >= 35))
+#define HAVE_SPAWN_TCSETPGRP 1
+#endif
 
-  // history command
-  if (strcmp(args[0], "history") == 0) {
-    show_history();
-    last_status = 0;
-    return 1;
+/**
+ * Start an external command with posix_spawn() (a vfork-style clone, so the shell's
+ * page tables are never copied). Redirection files are opened here in the parent and
+ * handed over as file actions. Returns 1 when spawned, 0 when the caller has to fork
+ * (here-documents read from our stdin, #!-less scripts, no way to pass the terminal),
+ * -1 after reporting an error.
+ */
+static int spawn_command(const char *path, char **args, int arg_count, int background,
+                         pid_t *pid) {
+  if (!path) return 0;  // let the fork path report "not found" the usual way
+#ifndef HAVE_SPAWN_TCSETPGRP
+  if (shell_is_interactive && !background) return 0;
+#endif
+
+  redir_list_t r;
+  if (parse_redirections(args, arg_count, &r) == -1) return -1;
+  if (redirections_need_stdin(&r)) {
+    free_redirections(&r);
+    return 0;
+  }
+  int *fds = malloc((r.count + 1) * sizeof(int));
+  if (!fds || open_redirections(&r, fds) == -1) {
+    free(fds);
+    free_redirections(&r);
+    return -1;
   }
 
-  // jobs command
-  if (strcmp(args[0], "jobs") == 0) {
-    list_jobs();
-    last_status = 0;
-    return 1;
+  posix_spawn_file_actions_t fa;
+  posix_spawnattr_t attr;
+  posix_spawn_file_actions_init(&fa);
+  posix_spawnattr_init(&attr);
+
+  // Same signal setup the forked child does by hand
+  sigset_t defaults, empty;
+  sigemptyset(&defaults);
+  sigaddset(&defaults, SIGINT);
+  sigaddset(&defaults, SIGQUIT);
+  sigaddset(&defaults, SIGTSTP);
+  sigaddset(&defaults, SIGTTIN);
+  sigaddset(&defaults, SIGTTOU);
+  sigemptyset(&empty);
+  short flags = POSIX_SPAWN_SETSIGDEF | POSIX_SPAWN_SETSIGMASK;
+  posix_spawnattr_setsigdefault(&attr, &defaults);
+  posix_spawnattr_setsigmask(&attr, &empty);
+  if (shell_is_interactive) {
+    flags |= POSIX_SPAWN_SETPGROUP;
+    posix_spawnattr_setpgroup(&attr, 0);  // child leads its own group
+#ifdef HAVE_SPAWN_TCSETPGRP
+    if (!background) posix_spawn_file_actions_addtcsetpgrp_np(&fa, shell_terminal);
+#endif
   }
+  posix_spawnattr_setflags(&attr, flags);
 
-  // fg command
-  if (strcmp(args[0], "fg") == 0) {
-    if (args[1] == NULL) {
-      fprintf(stderr, "fg: job id required\n");
-      last_status = 1;
-      return 1;
-    }
+  int rc = redirections_to_file_actions(&r, fds, &fa) == 0 ? 0 : -1;
+  if (rc == 0) rc = posix_spawn(pid, path, &fa, &attr, r.argv, environ);
+
+  posix_spawn_file_actions_destroy(&fa);
+  posix_spawnattr_destroy(&attr);
+  close_redirections(&r, fds);
+  free(fds);
+  free_redirections(&r);
+
+  // execvp() in a fork runs #!-less scripts through sh, and reports other exec failures
+  // with the usual 126/127 exit status
+  return rc == 0 ? 1 : rc == -1 ? -1 : 0;
+}
 
-    int job_id = atoi(args[1]);
-    for (int i = 0; i < MAX_JOBS; i++) {
-      if (jobs[i].job_id == job_id) {
-        printf("Bringing job %d to foreground: %s\n", job_id, jobs[i].command);
-        continue_job(&jobs[i], 1);
-        return 1;
+/*
+ * Set $? and PIPESTATUS from the exit codes of a finished pipeline's stages (a single
+ * entry for a simple command). With pipefail, $? is the rightmost non-zero code.
+ */
+static void set_pipeline_status(const int *codes, int n) {
+  char small[128];
+  size_t size = (size_t)n * 12 + 1;
+  char *buf = size <= sizeof(small) ? small : malloc(size);
+  size_t len = 0;
+  buf[0] = '\0';
+  for (int i = 0; i < n; i++) len += snprintf(buf + len, size - len, i ? " %d" : "%d", codes[i]);
+  set_var("PIPESTATUS", buf);
+  if (buf != small) free(buf);
+
+  last_status = codes[n - 1];
+  if (shell_options[OPT_PIPEFAIL]) {
+    for (int i = n - 1; i >= 0; i--) {
+      if (codes[i]) {
+        last_status = codes[i];
+        break;
       }
     }
-
-    fprintf(stderr, "fg: no such job: %d\n", job_id);
-    last_status = 1;
-    return 1;
   }
+}
 
-  // bg command
-  if (strcmp(args[0], "bg") == 0) {
-    if (args[1] == NULL) {
-      fprintf(stderr, "bg: job id required\n");
-      last_status = 1;
-      return 1;
+/* Wait for each process without job control and collect its exit code */
+static void wait_processes(const pid_t *pids, int n, int *codes) {
+  for (int i = 0; i < n; i++) {
+    int status;
+    struct rusage usage;
+    pid_t r;
+    while ((r = wait4(pids[i], &status, 0, &usage)) == -1 && errno == EINTR) {
     }
+    codes[i] = r == -1 ? 127 : wait_exit_code(status);
+    if (r != -1) note_child_usage(&usage);
+  }
+  if (job_count) reap_jobs();  // background jobs that ended meanwhile
+}
 
-    int job_id = atoi(args[1]);
-    for (int i = 0; i < MAX_JOBS; i++) {
-      if (jobs[i].job_id == job_id) {
-        printf("Running job %d in background: %s\n", job_id, jobs[i].command);
-        continue_job(&jobs[i], 0);
-        return 1;
-      }
-    }
+/*
+ * Put started processes under job control: a background job is announced, a foreground
+ * one given the terminal and waited for, then its statuses recorded.
+ */
+static void run_job(pid_t pgid, const pid_t *pids, int n, const char *command, int background) {
+  int job_id = add_job(pgid, pids, n, command, background);
+  if (job_id == -1) {
+    // No room in the job table: the best we can do is wait
+    int *codes = malloc(n * sizeof(int));
+    wait_processes(pids, n, codes);
+    set_pipeline_status(codes, n);
+    free(codes);
+    return;
+  }
+  job_t *job = find_job(job_id);
 
-    fprintf(stderr, "bg: no such job: %d\n", job_id);
-    last_status = 1;
-    return 1;
+  if (background) {
+    // Background job - print info and continue
+    char pid[16];
+    snprintf(pid, sizeof(pid), "%d", (int)pids[n - 1]);
+    set_var("!", pid);
+    if (shell_is_interactive) printf("[%d] %d\n", job_id, pids[0]);
+    put_job_in_background(job, 0);
+    last_status = 0;
+    return;
   }
 
-  return 0;
+  // Foreground job - wait for it
+  put_job_in_foreground(job, 0);
+
+  // Was it stopped with Ctrl+Z?
+  if (job->remaining > 0) {
+    printf("\n[%d] Stopped: %s\n", job_id, job->command);
+    job->notified = 1;
+    last_status = 128 + SIGTSTP;
+  } else {
+    // Job finished, clean up
+    int *codes = malloc(n * sizeof(int));
+    for (int k = 0; k < n; k++) codes[k] = wait_exit_code(job->status[k]);
+    set_pipeline_status(codes, n);
+    free(codes);
+    remove_job(job_id);
+  }
 }
 
 /**
@@ -351,8 +480,18 @@ int execute_command(char **args, int arg_count, int background) {
   pid_t pid;
   pid_t pgid = 0;
 
-  // Fork a child process
-  pid = fork();
+  // Resolve the program once in the parent so the child can execve() it directly
+  const char *path = lookup_command_path(args[0]);
+
+  fflush(stdout);  // neither path may replay our buffered output
+  int spawned = spawn_command(path, args, arg_count, background, &pid);
+  if (spawned == -1) {
+    last_status = 1;
+    return 0;
+  }
+
+  // Fork a child process when spawning is not possible
+  if (!spawned) pid = fork();
 
   if (pid == -1) {
     perror("fork error");
@@ -384,10 +523,10 @@ int execute_command(char **args, int arg_count, int background) {
     handle_redirection(args, &arg_count);
 
     // Try to run the command
-    if (execvp(args[0], args) == -1) {
-      perror("exec error");
-      exit(EXIT_FAILURE);
-    }
+    exec_command_path(path, args);
+    int err = errno;
+    perror("exec error");
+    _exit(err == ENOENT ? 127 : 126);  // exit() would rewind a script read from the same fd
   } else {
     /* parent */
 
@@ -396,43 +535,23 @@ int execute_command(char **args, int arg_count, int background) {
       if (pgid == 0) pgid = pid;
 
       setpgid(pid, pgid);
-    } else {
+    } else if (!background) {
       // Non-interactive mode: just wait for child
-      int status;
-      waitpid(pid, &status, 0);
-      last_status = status ? 1 : 0;
+      int code;
+      wait_processes(&pid, 1, &code);
+      set_pipeline_status(&code, 1);
       return 0;
     }
 
     // Build command string for job display
-    char command[MAX_INPUT_SIZE] = "";
-    for (int i = 0; i < arg_count; i++) {
-      strcat(command, args[i]);
-      if (i < arg_count - 1) strcat(command, " ");
-    }
-
-    // Add to our job list
-    int job_id = add_job(pid, pgid, command, background);
-    job_t *job = &jobs[job_id - 1];  // job_id is 1-based, array is 0-based
-
-    if (background) {
-      // Background job - print info and continue
-      printf("[%d] %d\n", job_id, pid);
-      put_job_in_background(job, 0);
-      return 0;
-    } else {
-      // Foreground job - wait for it
-      put_job_in_foreground(job, 0);
-
-      // Was it stopped with Ctrl+Z?
-      if (!job->running) {
-        printf("\n[%d] Stopped: %s\n", job_id, job->command);
-      } else {
-        // Job finished, clean up
-        last_status = 0;
-        remove_job(job_id);
-      }
-    }
+    size_t len;
+    char *command = NULL;
+    FILE *text = open_memstream(&command, &len);
+    for (int i = 0; text && i < arg_count; i++) fprintf(text, i ? " %s" : "%s", args[i]);
+    if (text) fclose(text);
+
+    run_job(pgid, &pid, 1, command, background);
+    free(command);
   }
 
   return 0;
@@ -482,34 +601,9 @@ void put_job_in_background(job_t *job, int cont) {
  * Wait for a job to finish or stop
  */
 void wait_for_job(job_t *job) {
-  int status;
-  pid_t pid;
-
-  do {
-    // Wait for any process in the job's process group
-    pid = waitpid(-job->pgid, &status, WUNTRACED);
-
-    if (pid < 0) {
-      // Handle interruptions
-      if (errno == EINTR) continue;
-
-      perror("waitpid");
-      return;
-    }
-
-    // Check what happened to the process
-    if (WIFSTOPPED(status)) {
-      // Process was stopped (Ctrl+Z)
-      job->running = 0;
-      return;
-    } else if (WIFEXITED(status) || WIFSIGNALED(status)) {
-      // Process finished or was killed
-      if (pid == job->pid) {
-        job->running = 0;
-        return;
-      }
-    }
-  } while (pid != job->pid);
+  // Each child event reaps whatever changed, background jobs included, so nothing is
+  // left a zombie while a long foreground job runs
+  while (job->remaining > 0 && job->running) wait_for_job_event(-1);
 }
 
 /**
@@ -535,264 +629,193 @@ void continue_job(job_t *job, int foreground) {
 }
 
 /**
- * Handle command pipelines (cmd1 | cmd2)
+ * Set up readline with our preferences
  */
-void execute_with_pipe(char *cmd1, char *cmd2) {
-  int pipefd[2];
-  pid_t pid1, pid2;
-  pid_t pgid = 0;
-
-  // Create the pipe
-  if (pipe(pipefd) == -1) {
-    perror("pipe error");
-    return;
-  }
-
-  // First process (left side of pipe)
-  pid1 = fork();
-  if (pid1 < 0) {
-    perror("fork error");
-    return;
-  }
-
-  if (pid1 == 0) {
-    // Child 1 - will write to pipe
-
-    if (shell_is_interactive) {
-      pid_t pid = getpid();
-
-      // First process becomes group leader
-      if (pgid == 0) pgid = pid;
-
-      setpgid(pid, pgid);
-
-      // Try to take terminal control
-      if (tcsetpgrp(shell_terminal, pgid) < 0) perror("tcsetpgrp failed in first child");
-
-      // Reset signals to defaults
-      signal(SIGINT, SIG_DFL);
-      signal(SIGQUIT, SIG_DFL);
-      signal(SIGTSTP, SIG_DFL);
-      signal(SIGTTIN, SIG_DFL);
-      signal(SIGTTOU, SIG_DFL);
-    }
-
-    // Close read end - we don't need it
-    close(pipefd[0]);
-
-    // Connect stdout to pipe
-    if (dup2(pipefd[1], STDOUT_FILENO) == -1) {
-      perror("dup2 error");
-      exit(EXIT_FAILURE);
-    }
-    close(pipefd[1]);
-
-    // Parse and run the command
-    int arg_count;
-    char **args = split_command_line(cmd1, &arg_count);
-    expand_aliases(&args, &arg_count);
-    if (execute_builtin(args)) {
-      free_tokens(args);
-      exit(EXIT_SUCCESS);
-    }
-    // Try external command
-    if (!execute_builtin(args)) {
-      // Handle any redirections (except stdout which goes to pipe)
-      handle_redirection(args, &arg_count);
-
-      // Run the command
-      if (execvp(args[0], args) == -1) {
-        perror("exec error");
-        exit(EXIT_FAILURE);
-      }
+/*
+ * readline's input function: wait for the terminal and for child events together, so a
+ * background job that finishes while the prompt is idle is reaped and reported at once
+ */
+static int getc_with_job_events(FILE *in) {
+  for (;;) {
+    struct pollfd fds[2] = {{fileno(in), POLLIN, 0}, {jobs_event_fd(), POLLIN, 0}};
+    if (poll(fds, fds[1].fd == -1 ? 1 : 2, -1) == -1 && errno != EINTR)
+      return line_editor->getc(in);
+    if ((fds[1].revents & POLLIN) && check_background_jobs()) {
+      fflush(stdout);
+      line_editor->on_new_line();
+      line_editor->redisplay();
     }
-
-    free_tokens(args);
-    exit(EXIT_SUCCESS);
+    if (fds[0].revents) return line_editor->getc(in);
   }
+}
 
-  // Remember process group for second child
-  if (pgid == 0) pgid = pid1;
-
-  // Make sure first child is in its process group
-  if (shell_is_interactive) setpgid(pid1, pgid);
-
-  // Second process (right side of pipe)
-  pid2 = fork();
-  if (pid2 < 0) {
-    perror("fork error");
-    return;
-  }
-
-  if (pid2 == 0) {
-    // Child 2 - will read from pipe
-
-    if (shell_is_interactive) {
-      // Join the same process group
-      setpgid(getpid(), pgid);
+void initialize_readline() {
+  // Read inputrc now rather than at the first prompt
+  line_editor->initialize();
+  // Tab key shows completion options
+  line_editor->bind_key('\t', line_editor->complete);
+  // Ctrl-R searches the history through its index
+  line_editor->bind_key(CTRL('R'), history_reverse_search);
+  *line_editor->getc_function = getc_with_job_events;
+}
 
-      // Reset signals
-      signal(SIGINT, SIG_DFL);
-      signal(SIGQUIT, SIG_DFL);
-      signal(SIGTSTP, SIG_DFL);
-      signal(SIGTTIN, SIG_DFL);
-      signal(SIGTTOU, SIG_DFL);
-    }
 
-    // Close write end - we don't need it
-    close(pipefd[1]);
 
-    // Connect stdin to pipe
-    if (dup2(pipefd[0], STDIN_FILENO) == -1) {
-      perror("dup2 error");
-      exit(EXIT_FAILURE);
-    }
-    close(pipefd[0]);
-
-    // Parse and run the command
-    int arg_count;
-    char **args = split_command_line(cmd2, &arg_count);
-    expand_aliases(&args, &arg_count);
-    if (execute_builtin(args)) {
-      free_tokens(args);
-      exit(EXIT_SUCCESS);
-    }
-    if (!execute_builtin(args)) {
-      // Handle any redirections
-      handle_redirection(args, &arg_count);
+/**
+ * Copy a command node's words, expand aliases on the copy, then run word expansion
+ */
+static char **prepare_args(ASTNode *cmd, int *arg_count) {
+  char **args = malloc((cmd->argc + 1) * sizeof(char *));
+  for (int i = 0; i < cmd->argc; i++) args[i] = strdup(cmd->argv[i]);
+  args[cmd->argc] = NULL;
+  *arg_count = cmd->argc;
+  expand_aliases(&args, arg_count);
+  char **expanded = expand_words(args, *arg_count, arg_count);
+  free_tokens(args);
+  return expanded;
+}
 
-      // Run the command
-      if (execvp(args[0], args) == -1) {
-        perror("exec error");
-        exit(EXIT_FAILURE);
-      }
-    }
+/**
+ * NAME=value word? (NAME must be a valid identifier)
+ */
+static int is_assignment(const char *word) {
+  if (!(isalpha((unsigned char)*word) || *word == '_')) return 0;
+  const char *p = word + 1;
+  while (isalnum((unsigned char)*p) || *p == '_') p++;
+  return *p == '=';
+}
 
-    free_tokens(args);
-    exit(EXIT_SUCCESS);
-  }
+/**
+ * Is this stage a command whose name needs no expansion and is not an alias, function,
+ * built-in or assignment?
+ */
+static int is_literal_external(ASTNode *stage) {
+  if (stage->type != NODE_COMMAND || stage->argc == 0) return 0;
+  const char *name = stage->argv[0];
+  if (strpbrk(name, "$`'\"\\~*?[=")) return 0;
+  return !get_alias(name) && !find_function(name) && !find_builtin(name);
+}
 
-  // Parent process
-  if (!shell_is_interactive) {
-    // Non-interactive mode: just wait for both children
-    close(pipefd[0]);
-    close(pipefd[1]);
-    int status;
-    waitpid(pid1, &status, 0);
-    waitpid(pid2, &status, 0);
+/**
+ * Build a display string for a pipeline stage (used in the job list)
+ */
+static void describe_stage(ASTNode *stage, FILE *text) {
+  if (stage->type != NODE_COMMAND) {
+    fputs("(...)", text);
     return;
   }
+  for (int i = 0; i < stage->argc; i++) fprintf(text, i ? " %s" : "%s", stage->argv[i]);
+}
 
-  // Make sure second child is in the pipeline's process group
-  setpgid(pid2, pgid);
-
-  // Close our copy of the pipe
-  close(pipefd[0]);
-  close(pipefd[1]);
-
-  // Add job to our job list
-  char pipeline_cmd[MAX_INPUT_SIZE];
-  snprintf(pipeline_cmd, MAX_INPUT_SIZE, "%s | %s", cmd1, cmd2);
-  int job_id = add_job(pid1, pgid, pipeline_cmd, 0);
-  job_t *job = &jobs[job_id - 1];
-
-  // Run in foreground
-  put_job_in_foreground(job, 0);
-
-  // Check if it was stopped
-  if (!job->running) {
-    printf("\n[%d] Stopped: %s\n", job_id, job->command);
-  } else {
-    // Job finished, clean up
-    remove_job(job_id);
+/*
+ * Pipe buffer size for a pipeline: a leading PIPEBUF=size word on its first stage, else
+ * $PIPEBUF (shell variable or environment). Sizes take a K, M or G suffix. Returns 0 to
+ * keep the kernel default.
+ */
+static long pipe_buffer_size(const char *override) {
+  const char *value = override;
+  if (!value) value = get_var("PIPEBUF");
+  if (!value) value = getenv("PIPEBUF");
+  if (!value || !*value) return 0;
+
+  char *end;
+  long size = strtol(value, &end, 10);
+  switch (*end) {
+    case 'k': case 'K': size <<= 10; end++; break;
+    case 'm': case 'M': size <<= 20; end++; break;
+    case 'g': case 'G': size <<= 30; end++; break;
+  }
+  if (end == value || *end || size < 0 || size > INT_MAX) {
+    fprintf(stderr, "ash: PIPEBUF: %s: invalid size\n", value);
+    return 0;
   }
+  return size;
 }
 
-/**
- * Set up readline with our preferences
- */
-void initialize_readline() {
-  // Tab key shows completion options
-  rl_bind_key('\t', rl_complete);
+/* Can this pipeline stage run in the shell process (built-in, function or compound)? */
+static int runs_in_shell(ASTNode *stage) {
+  if (stage->type != NODE_COMMAND) return 1;
+  if (stage->argc == 0) return 0;
+  const char *name = stage->argv[0];
+  return !get_alias(name) && (find_builtin(name) || find_function(name));
 }
 
+// Execute an N-stage pipeline (the stages are the node's body list)
+int execute_pipeline(ASTNode *pipeline) {
+  int background = (pipeline->flags & NODE_BG) != 0;
+  int n = 0;
+  for (ASTNode *s = pipeline->body; s; s = s->next) n++;
+  if (n <= 1) return 0;  // should not happen
 
+  pid_t pgid = 0;
 
-// *** NEW: helper to split a command line into pipeline segments while respecting quotes ***
-static int split_pipeline(char *input, char **segments, int max_segments) {
-  enum { NORM, SQ, DQ } st = NORM;
-  char *start = input;
-  int count = 0;
-  for (char *p = input; *p; p++) {
-    if (st == NORM) {
-      if (*p == '\\' && *(p + 1)) {
-        p++;  // skip escaped char
-        continue;
-      }
-      if (*p == '\'') {
-        st = SQ;
-      } else if (*p == '"') {
-        st = DQ;
-      } else if (*p == '|' && *(p + 1) != '|') {
-        *p = '\0';
-        if (count < max_segments) segments[count++] = trim(start);
-        start = p + 1;
-      }
-    } else if (st == SQ) {
-      if (*p == '\'') st = NORM;
-    } else if (st == DQ) {
-      if (*p == '"')
-        st = NORM;
-      else if (*p == '\\' && *(p + 1))
-        p++;  // skip escaped char
-    }
+  // PIPEBUF=size in front of the first stage applies to this pipeline only; the stage
+  // runs from a copy of its node without that word
+  ASTNode first = *pipeline->body;
+  char *pipebuf = NULL;
+  if (first.type == NODE_COMMAND && first.argc > 1 && strncmp(first.argv[0], "PIPEBUF=", 8) == 0) {
+    pipebuf = expand_word(first.argv[0] + 8);
+    first.argv++;
+    first.argc--;
   }
-  if (count < max_segments) segments[count++] = trim(start);
-  return count;
-}
-
-// *** NEW: Execute an N-stage pipeline (segments[0..n-1]) ***
-static void execute_pipeline(char **segments, int n, int background) {
-  if (n <= 1) return;  // should not happen
-
-  int pipefds[32][2];  // supports up to 33 cmds which is fine for now
-  if (n - 1 > 32) {
-    fprintf(stderr, "ash: too many pipeline stages\n");
-    return;
+  long pipe_size = pipe_buffer_size(pipebuf);
+  free(pipebuf);
+
+  // lastpipe: without job control, a built-in or compound last stage runs in the shell
+  // itself reading the pipe, so its assignments (read x, loops) outlive the pipeline
+  ASTNode *last = pipeline->body;
+  while (last->next) last = last->next;
+  int in_shell =
+      shell_options[OPT_LASTPIPE] && !background && !shell_is_interactive && runs_in_shell(last);
+
+  // Pipes are made one stage ahead (close-on-exec), so each process only ever holds the
+  // read end feeding it and the pipe to its successor
+  int prev_read = -1;  // read end of the pipe into the current stage
+  int spawned = 0;
+  pid_t *pids = malloc(n * sizeof(pid_t));
+  int *codes = malloc(n * sizeof(int));
+  if (!pids || !codes) {
+    perror("malloc");
+    free(pids);
+    free(codes);
+    return 1;
   }
-
-  // create required pipes beforehand
-  for (int i = 0; i < n - 1; i++) {
-    if (pipe(pipefds[i]) == -1) {
+  ASTNode *stage = &first;
+  for (int i = 0; i < n - in_shell; i++, stage = stage->next) {
+    int next[2] = {-1, -1};
+    if (i < n - 1 && pipe2(next, O_CLOEXEC) == -1) {
       perror("pipe");
-      // close previously created pipes
-      for (int k = 0; k < i; k++) {
-        close(pipefds[k][0]);
-        close(pipefds[k][1]);
-      }
-      return;
+      break;
+    }
+    // Bigger pipes mean fewer context switches for bulk data; only warn once
+    if (pipe_size && next[0] != -1 && fcntl(next[0], F_SETPIPE_SZ, (int)pipe_size) == -1) {
+      fprintf(stderr, "ash: PIPEBUF: cannot set pipe size to %ld: %s\n", pipe_size,
+              strerror(errno));
+      pipe_size = 0;
     }
-  }
 
-  pid_t pgid = 0;
-  pid_t first_pid = 0;
+    // Stages naming a plain external program are resolved here, counting the hash hit in
+    // the shell itself; anything else is looked up in the child after expansion
+    const char *stage_path = NULL;
+    if (is_literal_external(stage)) stage_path = lookup_command_path(stage->argv[0]);
 
-  for (int i = 0; i < n; i++) {
+    fflush(stdout);
     pid_t pid = fork();
     if (pid == -1) {
       perror("fork");
-      // TODO: we could clean up children here but for simplicity just bail
-      return;
+      close(next[0]);
+      close(next[1]);
+      break;
     }
 
     if (pid == 0) {
       // Child process
+      pid_t child_pid = getpid();
+      if (pgid == 0)
+        pgid = child_pid;  // the very first child sets pgid but parent hasn't updated yet
+      // place ourselves into pgid before exec, so the parent's waitpid(-pgid) sees us
+      setpgid(child_pid, pgid);
       if (shell_is_interactive) {
-        pid_t child_pid = getpid();
-        if (pgid == 0)
-          pgid = child_pid;  // the very first child sets pgid but parent hasn't updated yet
-        // place ourselves into pgid (may already be set for later children)
-        setpgid(child_pid, pgid);
         if (!background) {
           // Foreground: first child (or all) grabs terminal
           tcsetpgrp(shell_terminal, pgid);
@@ -806,178 +829,501 @@ static void execute_pipeline(char **segments, int n, int background) {
       }
 
       // Set up stdin/stdout depending on our position in pipeline
-      if (i > 0) {
+      if (prev_read != -1) {
         // not first: connect stdin to previous pipe read end
-        dup2(pipefds[i - 1][0], STDIN_FILENO);
+        dup2(prev_read, STDIN_FILENO);
+        close(prev_read);
       }
-      if (i < n - 1) {
+      if (next[1] != -1) {
         // not last: connect stdout to current pipe write end
-        dup2(pipefds[i][1], STDOUT_FILENO);
+        dup2(next[1], STDOUT_FILENO);
+        close(next[0]);
+        close(next[1]);
       }
 
-      // Close all pipe fds in child (not needed anymore after dup)
-      for (int k = 0; k < n - 1; k++) {
-        close(pipefds[k][0]);
-        close(pipefds[k][1]);
+      // Compound stages (loops, groups, ...) run through the AST executor, without job
+      // control of their own
+      if (stage->type != NODE_COMMAND) {
+        shell_is_interactive = 0;
+        int status = exec_node(stage);
+        fflush(stdout);
+        _exit(status);
       }
 
-      // Parse segment into argv
+      if (stage->argc > 0 && strcmp(stage->argv[0], "[[") == 0)
+        _exit(builtin_cond(stage->argv, stage->argc));
+
+      // Expand the stage's words into argv
       int arg_count = 0;
-      char **args = split_command_line(segments[i], &arg_count);
-      expand_aliases(&args, &arg_count);
+      char **args = prepare_args(stage, &arg_count);
 
-      // Built-in support inside pipeline (run in subshell)
-      if (execute_builtin(args)) {
-        free_tokens(args);
-        _exit(EXIT_SUCCESS);
+      handle_redirection(args, &arg_count);
+
+      // Built-ins and functions run in this subshell
+      const builtin_t *builtin = find_builtin(args[0]);
+      int status;
+      if ((!builtin || !(builtin->flags & BUILTIN_SPECIAL)) &&
+          exec_function_if_defined(args, arg_count, &status)) {
+        fflush(stdout);
+        _exit(status);
       }
-      // Not a builtin -> external command
-      if (!execute_builtin(args)) {
-        handle_redirection(args, &arg_count);
-        execvp(args[0], args);
-        perror("exec");
+      if (builtin) {
+        status = run_builtin(builtin, args);
+        fflush(stdout);
+        _exit(status);
       }
-      free_tokens(args);
-      _exit(EXIT_SUCCESS);
+      // Not a builtin -> external command
+      exec_command_path(stage_path ? stage_path : lookup_command_path(args[0]), args);
+      int err = errno;
+      perror("exec");
+      _exit(err == ENOENT ? 127 : 126);
     }
 
-    // Parent
-    if (pgid == 0) {
-      pgid = pid;  // first child sets the pgid for the pipeline
-      first_pid = pid;
-    }
+    // Parent: keep only the read end the next stage needs
+    if (prev_read != -1) close(prev_read);
+    if (next[1] != -1) close(next[1]);
+    prev_read = next[0];
+    pids[spawned++] = pid;
+
+    if (pgid == 0) pgid = pid;  // first child sets the pgid for the pipeline
     // ensure each child joins same pgid
     setpgid(pid, pgid);
   }
 
-  // Parent: close all pipe fds
-  for (int i = 0; i < n - 1; i++) {
-    close(pipefds[i][0]);
-    close(pipefds[i][1]);
+  // A failed pipe() or fork() leaves the stages already started to be reaped
+  if (spawned < n - in_shell) {
+    if (prev_read != -1) close(prev_read);
+    prev_read = -1;
+    in_shell = 0;
+    if (spawned == 0) {
+      free(pids);
+      free(codes);
+      last_status = 1;
+      return 1;
+    }
+  }
+
+  int saved_stdin = -1;
+  if (in_shell) {
+    saved_stdin = fcntl(STDIN_FILENO, F_DUPFD_CLOEXEC, 10);
+    dup2(prev_read, STDIN_FILENO);
+    close(prev_read);
+  }
+
+  // Stages that could not be started count as failed
+  for (int i = spawned; i < n; i++) codes[i] = 1;
+  if (in_shell) {
+    codes[n - 1] = exec_node(stage);
+    if (saved_stdin != -1) {
+      dup2(saved_stdin, STDIN_FILENO);
+      close(saved_stdin);
+    } else {
+      close(STDIN_FILENO);
+    }
   }
 
-  // Now handle job control / waiting similar to execute_with_pipe()
-  if (!shell_is_interactive) {
+  // Wait for the stages here, or put them under job control as one job
+  if (!shell_is_interactive && !background) {
     // just wait synchronously for all children
-    int status;
-    for (int i = 0; i < n; i++) {
-      waitpid(-pgid, &status, 0);
+    wait_processes(pids, spawned, codes);
+    set_pipeline_status(codes, n);
+  } else {
+    // Build combined command string
+    size_t len;
+    char *pipeline_cmd = NULL;
+    FILE *text = open_memstream(&pipeline_cmd, &len);
+    for (stage = pipeline->body; text && stage; stage = stage->next) {
+      describe_stage(stage, text);
+      if (stage->next) fputs(" | ", text);
     }
-    return;
+    if (text) fclose(text);
+    run_job(pgid, pids, spawned, pipeline_cmd, background);
+    free(pipeline_cmd);
   }
+  free(pids);
+  free(codes);
+  return last_status;
+}
 
-  // Build combined command string
-  char pipeline_cmd[MAX_INPUT_SIZE] = "";
-  for (int i = 0; i < n; i++) {
-    strcat(pipeline_cmd, segments[i]);
-    if (i < n - 1) strcat(pipeline_cmd, " | ");
+/**
+ * Run a compound command, function or built-in in the background as a job
+ */
+int execute_background(ASTNode *node) {
+  fflush(stdout);
+  pid_t pid = fork();
+  if (pid == -1) {
+    perror("fork");
+    last_status = 1;
+    return 1;
+  }
+  if (pid == 0) {
+    if (shell_is_interactive) {
+      setpgid(0, 0);
+      signal(SIGINT, SIG_DFL);
+      signal(SIGQUIT, SIG_DFL);
+      signal(SIGTSTP, SIG_DFL);
+      signal(SIGTTIN, SIG_DFL);
+      signal(SIGTTOU, SIG_DFL);
+      shell_is_interactive = 0;  // no job control inside the job
+    }
+    node->flags &= ~NODE_BG;
+    int status = exec_node(node);
+    fflush(stdout);
+    _exit(status);
+  }
+  if (shell_is_interactive) setpgid(pid, pid);
+
+  size_t len;
+  char *command = NULL;
+  FILE *text = open_memstream(&command, &len);
+  if (text) {
+    describe_stage(node, text);
+    fclose(text);
   }
+  run_job(shell_is_interactive ? pid : 0, &pid, 1, command, 1);
+  free(command);
+  return 0;
+}
 
-  int job_id = add_job(first_pid, pgid, pipeline_cmd, background);
-  job_t *job = &jobs[job_id - 1];
+static double usage_seconds(struct timeval after, struct timeval before) {
+  return (after.tv_sec - before.tv_sec) + (after.tv_usec - before.tv_usec) / 1e6;
+}
 
-  if (background) {
-    printf("[%d] %d\n", job_id, first_pid);
-    put_job_in_background(job, 0);
-    return;
+/*
+ * time [-p] pipeline: run the pipeline, then report on stderr its wall-clock time and
+ * the CPU time the shell and its children spent on it; without -p also the peak RSS of
+ * its processes and their context switches.
+ */
+int execute_timed(ASTNode *pipeline) {
+  struct timespec start, end;
+  struct rusage self_before, kids_before, self_after, kids_after;
+  long outer_peak = take_child_peak_rss();  // a time around this one still sees ours
+  getrusage(RUSAGE_SELF, &self_before);
+  getrusage(RUSAGE_CHILDREN, &kids_before);
+  clock_gettime(CLOCK_MONOTONIC, &start);
+
+  pipeline->flags &= ~NODE_TIMED;
+  int status = exec_node(pipeline);
+  pipeline->flags |= NODE_TIMED;
+
+  clock_gettime(CLOCK_MONOTONIC, &end);
+  getrusage(RUSAGE_SELF, &self_after);
+  getrusage(RUSAGE_CHILDREN, &kids_after);
+  long peak = take_child_peak_rss();
+  // Children reaped outside the job code only show up in RUSAGE_CHILDREN's high-water mark
+  if (kids_after.ru_maxrss > kids_before.ru_maxrss && kids_after.ru_maxrss > peak)
+    peak = kids_after.ru_maxrss;
+  struct rusage outer = {.ru_maxrss = outer_peak > peak ? outer_peak : peak};
+  note_child_usage(&outer);
+
+  double real = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+  double user = usage_seconds(self_after.ru_utime, self_before.ru_utime) +
+                usage_seconds(kids_after.ru_utime, kids_before.ru_utime);
+  double sys = usage_seconds(self_after.ru_stime, self_before.ru_stime) +
+               usage_seconds(kids_after.ru_stime, kids_before.ru_stime);
+  if (pipeline->flags & NODE_TIME_POSIX) {
+    fprintf(stderr, "real %.2f\nuser %.2f\nsys %.2f\n", real, user, sys);
+    return status;
   }
 
-  // Foreground: give terminal to pipeline and wait
-  put_job_in_foreground(job, 0);
-  if (!job->running) {
-    printf("\n[%d] Stopped: %s\n", job_id, job->command);
-  } else {
-    remove_job(job_id);
-  }
+  char buf[32];
+  format_duration(buf, sizeof(buf), real);
+  fprintf(stderr, "\nreal\t%s\n", buf);
+  format_duration(buf, sizeof(buf), user);
+  fprintf(stderr, "user\t%s\n", buf);
+  format_duration(buf, sizeof(buf), sys);
+  fprintf(stderr, "sys\t%s\n", buf);
+  fprintf(stderr, "maxrss\t%ldK\n", peak);
+  long voluntary = (self_after.ru_nvcsw - self_before.ru_nvcsw) +
+                   (kids_after.ru_nvcsw - kids_before.ru_nvcsw);
+  long involuntary = (self_after.ru_nivcsw - self_before.ru_nivcsw) +
+                     (kids_after.ru_nivcsw - kids_before.ru_nivcsw);
+  fprintf(stderr, "csw\t%ld voluntary, %ld involuntary\n", voluntary, involuntary);
+  return status;
 }
 
-/**
- * Parse input and run the command
+/*
+ * Run a function or built-in inside the shell, with its redirections applied for the
+ * duration of the call and then undone. Returns 0 if args names neither.
  */
-int parse_and_execute(char *input) {
-  // Nothing to do for empty input
-  if (input == NULL || strlen(input) == 0) return 0;
+static int exec_in_shell(char **args, int arg_count) {
+  // Special built-ins take precedence over functions, other built-ins do not
+  const builtin_t *builtin = find_builtin(args[0]);
+  ASTNode *fn = builtin && (builtin->flags & BUILTIN_SPECIAL) ? NULL : find_function(args[0]);
+  if (!builtin && !fn) return 0;
+
+  redir_list_t r;
+  if (parse_redirections(args, arg_count, &r) == -1) {
+    last_status = 1;
+    return 1;
+  }
+  int *saved = r.count ? malloc(r.count * sizeof(int)) : NULL;
+  if (r.count && (!saved || save_and_apply_redirections(&r, saved) == -1)) {
+    last_status = 1;
+  } else {
+    int status;
+    if (fn && exec_function_if_defined(r.argv, r.argc, &status))
+      last_status = status;
+    else
+      run_builtin(builtin, r.argv);
+    if (r.count) restore_redirections(&r, saved, r.count);
+  }
+  free(saved);
+  free_redirections(&r);
+  return 1;
+}
 
-  // Trim whitespace at both ends early
-  input = trim(input);
-
-  // Logical operators (&&, ||) handled first
-  int is_and = 0;
-  char *op_ptr = find_logic_op(input, &is_and);
-  if (op_ptr) {
-    char *right = op_ptr + 2;
-    *op_ptr = '\0';
-    char *left = trim(input);
-    right = trim(right);
-    int status_left = parse_and_execute(left);
-    int status_total = status_left;
-    if ((is_and && status_left == 0) || (!is_and && status_left != 0))
-      status_total = parse_and_execute(right);
-    last_status = status_total;
-    return status_total;
-  }
-
-  // Background (&) detection (needs quoting awareness but keep simple)
-  int background = 0;
-  size_t len = strlen(input);
-  if (len > 0) {
-    // strip trailing spaces
-    while (len > 0 && (input[len - 1] == ' ' || input[len - 1] == '\t')) {
-      input[--len] = '\0';
-    }
-    if (len > 0 && input[len - 1] == '&') {
-      background = 1;
-      input[--len] = '\0';
-      // remove any trailing spaces again
-      while (len > 0 && (input[len - 1] == ' ' || input[len - 1] == '\t')) {
-        input[--len] = '\0';
-      }
+/* Does the word contain a command substitution, $(...) or `...`, outside single quotes? */
+static int has_command_subst(const char *w) {
+  int in_double = 0;
+  for (const char *p = w; *p; p++) {
+    if (*p == '\\' && p[1]) {
+      p++;
+    } else if (*p == '"') {
+      in_double = !in_double;
+    } else if (*p == '\'' && !in_double) {
+      const char *q = strchr(p + 1, '\'');
+      if (!q) return 0;
+      p = q;
+    } else if (*p == '`' || (p[0] == '$' && p[1] == '(' && p[2] != '(')) {
+      return 1;
     }
   }
+  return 0;
+}
 
-  // Split pipelines
-  char *segments[64];
-  int seg_count = split_pipeline(input, segments, 64);
-  if (seg_count > 1) {
-    execute_pipeline(segments, seg_count, background);
-    return 0;
-  }
+/*
+ * Does the command word name a function or a built-in? Such a command run with '&' has
+ * to be forked as a job of its own, or it would run in the foreground.
+ */
+static int names_shell_command(char **args, int arg_count) {
+  int i = 0;
+  while (i < arg_count && is_assignment(args[i])) i++;
+  return i < arg_count && (find_builtin(args[i]) || find_function(args[i]));
+}
 
-  // No pipeline – fall back to single command execution
-  // Parse into argv
-  int arg_count;
-  char **args = split_command_line(segments[0], &arg_count);
-  if (args[0] == NULL) {
+/**
+ * Run a simple command node: assignments, functions, built-ins or an external program
+ */
+int execute_simple(ASTNode *cmd) {
+  int arg_count = cmd->argc;
+  char **args = malloc((arg_count + 1) * sizeof(char *));
+  for (int i = 0; i < arg_count; i++) args[i] = strdup(cmd->argv[i]);
+  args[arg_count] = NULL;
+  if (arg_count == 0) {
     free_tokens(args);
     return 0;
   }
   expand_aliases(&args, &arg_count);
-  if (execute_builtin(args)) {
+  if ((cmd->flags & NODE_BG) && names_shell_command(args, arg_count)) {
     free_tokens(args);
-    return 0;
+    return execute_background(cmd);
+  }
+
+  // [[ ]] expands its own operands (no field splitting, patterns on the right)
+  expansion_failed = 0;
+  if (strcmp(args[0], "[[") == 0) {
+    last_status = builtin_cond(args, arg_count);
+    if (expansion_failed) last_status = 1;
+    free_tokens(args);
+    return last_status;
   }
+
   // Variable assignment detection must come after alias expansion
   int all_assignments = 1;
   for (int i = 0; i < arg_count; i++) {
-    char *eq = strchr(args[i], '=');
-    if (!(eq && eq != args[i])) {
+    if (!is_assignment(args[i])) {
       all_assignments = 0;
       break;
     }
   }
   if (all_assignments) {
+    // Status is 0 unless a command substitution in a value sets it; $? in a value is
+    // still that of the previous command
+    int status = 0;
     for (int i = 0; i < arg_count; i++) {
       char *eq = strchr(args[i], '=');
       *eq = '\0';
-      set_var(args[i], eq + 1);
+      char *value = expand_word(eq + 1);
+      if (!expansion_failed) set_var(args[i], value);
+      free(value);
+      if (expansion_failed) {
+        status = 1;
+        break;
+      }
+      if (has_command_subst(eq + 1)) status = last_status;
     }
     free_tokens(args);
-    return 0;
+    last_status = status;
+    return last_status;
   }
-  expand_vars(args, arg_count);
-  expand_globs(&args, &arg_count);
-  execute_command(args, arg_count, background);
+  char **expanded = expand_words(args, arg_count, &arg_count);
   free_tokens(args);
+  args = expanded;
+  if (expansion_failed) last_status = 1;  // the error has been reported; do not run it
+  if (arg_count == 0 || expansion_failed) {
+    free_tokens(args);
+    return last_status;
+  }
+
+  if (!exec_in_shell(args, arg_count))
+    execute_command(args, arg_count, (cmd->flags & NODE_BG) != 0);
+  free_tokens(args);
+  return last_status;
+}
+
+/**
+ * Parse input and run the command
+ */
+int parse_and_execute(char *input) {
+  // Nothing to do for empty input
+  if (input == NULL || strlen(input) == 0) return 0;
+
+  int ok;
+  ASTNode *tree = parse_string(input, &ok);
+  if (!ok) {
+    last_status = 2;
+    return last_status;
+  }
+  int status = exec_ast(tree);
+  free_ast(tree);
+  last_status = status;
+  return status;
+}
+
+/**
+ * Can this word change shell state when expanded? (${x=..}, $((x=..)), $((x++)))
+ */
+static int word_has_side_effects(const char *w) {
+  for (const char *p = w; *p; p++) {
+    if (p[0] == '$' && p[1] == '{') {
+      for (const char *q = p + 2; *q && *q != '}'; q++)
+        if (*q == '=') return 1;
+    } else if (p[0] == '$' && p[1] == '(' && p[2] == '(') {
+      for (const char *q = p + 3; *q && !(q[0] == ')' && q[1] == ')'); q++) {
+        // '=' not part of == != <= >= (but <<= and >>= do assign)
+        int cmp = q[-1] == '=' || q[-1] == '!' ||
+                  ((q[-1] == '<' || q[-1] == '>') && q[-2] != q[-1]) || q[1] == '=';
+        if (q[0] == '=' && !cmp) return 1;
+        if ((q[0] == '+' && q[1] == '+') || (q[0] == '-' && q[1] == '-')) return 1;
+      }
+    }
+  }
   return 0;
 }
 
+/**
+ * Would running this list inside the shell be indistinguishable from a subshell?
+ * External commands, ( ) and the leading pipeline stages fork on their own, so they are
+ * always fine; anything that could touch variables, cwd, functions or loop state is not.
+ */
+static int subst_is_pure(ASTNode *node, int depth) {
+  if (depth > 8) return 0;
+  for (; node; node = node->next) {
+    if (node->flags & NODE_BG) return 0;
+    switch (node->type) {
+      case NODE_COMMAND: {
+        if (node->argc == 0) break;
+        for (int i = 0; i < node->argc; i++)
+          if (word_has_side_effects(node->argv[i])) return 0;
+        const char *name = node->argv[0];
+        if (is_assignment(name) || get_alias(name)) return 0;
+        if (strpbrk(name, "$`'\"\\")) return 0;  // command name known only at run time
+        if (strcmp(name, "break") == 0 || strcmp(name, "continue") == 0) return 0;
+        const builtin_t *builtin = find_builtin(name);
+        ASTNode *fn = builtin && (builtin->flags & BUILTIN_SPECIAL) ? NULL : find_function(name);
+        if (fn) {
+          if (!subst_is_pure(fn, depth + 1)) return 0;
+        } else if (builtin && !(builtin->flags & BUILTIN_NOFORK)) {
+          return 0;
+        }
+        break;
+      }
+      case NODE_PIPELINE: {
+        // Only the last stage can run in the shell: when it is alone, or under lastpipe
+        ASTNode *last = node->body;
+        while (last->next) last = last->next;
+        if ((last == node->body || shell_options[OPT_LASTPIPE]) && !subst_is_pure(last, depth))
+          return 0;
+        break;
+      }
+      case NODE_SUBSHELL:
+        break;
+      case NODE_FOR:
+      case NODE_FUNCTION:
+        return 0;
+      case NODE_CASE:
+        if (word_has_side_effects(node->var_name)) return 0;
+        for (ASTNode *item = node->body; item; item = item->next)
+          if (!subst_is_pure(item->body, depth)) return 0;
+        break;
+      default:
+        if (!subst_is_pure(node->cond, depth) || !subst_is_pure(node->body, depth) ||
+            !subst_is_pure(node->else_branch, depth))
+          return 0;
+        break;
+    }
+  }
+  return 1;
+}
+
+/**
+ * Command substitution without a fork: run cmd with stdout on a memfd and read it back
+ */
+int capture_in_process(const char *cmd, char **out, size_t *len) {
+  int ok;
+  ASTNode *tree = parse_string(cmd, &ok);
+  if (!ok) {
+    // The syntax error has been reported; a subshell would only report it again
+    last_status = 2;
+    *out = strdup("");
+    *len = 0;
+    return 1;
+  }
+  if (!subst_is_pure(tree, 0)) {
+    free_ast(tree);
+    return 0;
+  }
+
+  int mfd = memfd_create("ash-subst", MFD_CLOEXEC);
+  if (mfd == -1) {
+    free_ast(tree);
+    return 0;
+  }
+  fflush(stdout);
+  int saved_out = dup(STDOUT_FILENO);
+  int saved_err = dup(STDERR_FILENO);
+  int devnull = open("/dev/null", O_WRONLY | O_CLOEXEC);
+  dup2(mfd, STDOUT_FILENO);
+  if (devnull != -1) {
+    dup2(devnull, STDERR_FILENO);
+    close(devnull);
+  }
+
+  int failed = expansion_failed;  // the word being expanded keeps its own errors
+  int status = exec_ast(tree);
+  free_ast(tree);
+  expansion_failed = failed;
+
+  fflush(stdout);
+  dup2(saved_out, STDOUT_FILENO);
+  dup2(saved_err, STDERR_FILENO);
+  close(saved_out);
+  close(saved_err);
+  last_status = status;
+
+  off_t size = lseek(mfd, 0, SEEK_END);
+  if (size < 0) size = 0;
+  char *buf = malloc((size_t)size + 1);
+  size_t got = 0;
+  while (got < (size_t)size) {
+    ssize_t n = pread(mfd, buf + got, (size_t)size - got, (off_t)got);
+    if (n <= 0) break;
+    got += (size_t)n;
+  }
+  close(mfd);
+  buf[got] = '\0';
+  *out = buf;
+  *len = got;
+  return 1;
+}
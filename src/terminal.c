@@ -1,7 +1,7 @@
 #include "terminal.h"
+#include "lineedit.h"
 #include <signal.h>
 #include <stdio.h>
-#include <readline/readline.h>
 #include <unistd.h>
 #include <errno.h>
 
@@ -17,8 +17,10 @@ static void handle_sigint(int sig) {
 
   // Print a newline and redisplay prompt
   printf("\n");
-  rl_on_new_line();
-  rl_redisplay();
+  if (line_editor) {
+    line_editor->on_new_line();
+    line_editor->redisplay();
+  }
 }
 
 // Handle Ctrl+Z similarly
@@ -26,8 +28,10 @@ static void handle_sigtstp(int sig) {
   (void)sig;  // Unused
 
   printf("\n");
-  rl_on_new_line();
-  rl_redisplay();
+  if (line_editor) {
+    line_editor->on_new_line();
+    line_editor->redisplay();
+  }
 }
 
 // Set up our signal handlers for interactive use
@@ -57,9 +61,9 @@ void terminal_init(void) {
   signal(SIGTTIN, SIG_IGN);  // Terminal read from bg
   signal(SIGTTOU, SIG_IGN);  // Terminal write from bg
 
-  // Create our own process group
+  // Create our own process group (a session leader, as under a pty, already leads one)
   shell_pgid = getpid();
-  if (setpgid(shell_pgid, shell_pgid) < 0) {
+  if (getpgrp() != shell_pgid && setpgid(shell_pgid, shell_pgid) < 0) {
     perror("ash: couldn't put the shell in its own process group");
     _exit(1);
   }
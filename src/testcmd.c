@@ -0,0 +1,383 @@
+#include "testcmd.h"
+#include "vars.h"
+#include <errno.h>
+#include <fnmatch.h>
+#include <regex.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+/*
+ * test / [ and [[ ]].
+ *
+ * Both forms share one recursive-descent evaluator over a word vector:
+ *   or    := and  ( -o | || ) and ...
+ *   and   := not  ( -a | && ) not ...
+ *   not   := ! not | primary
+ *   prim  := ( or ) | unary-op word | word binary-op word | word
+ * test additionally applies the POSIX rules for 0-4 arguments first. For [[ the words
+ * arrive unexpanded: operators are recognised on the raw text, operands are expanded
+ * without field splitting, and the right side of == / != is a pattern. The right side of
+ * && / || is only parsed, never expanded, when the left side already decides the result.
+ *
+ * File tests on the same path within one command share a single stat() call.
+ */
+
+#define STAT_CACHE 8
+
+typedef struct {
+  const char *path;
+  int link;  // lstat() rather than stat()
+  int rc;
+  struct stat st;
+} stat_entry_t;
+
+typedef struct {
+  char **av;
+  int ac;
+  int pos;
+  int err;
+  int cond;       // [[ ]] rather than test
+  int skip;       // parsing an operand of && / || that cannot change the result
+  char **owned;   // expansions to free, one slot per word
+  stat_entry_t stats[STAT_CACHE];
+  int nstats;
+} test_ctx_t;
+
+static int eval_or(test_ctx_t *T);
+
+static void test_error(test_ctx_t *T, const char *msg, const char *arg) {
+  if (!T->err) {
+    if (arg)
+      fprintf(stderr, "%s: %s: %s\n", T->cond ? "[[" : "test", arg, msg);
+    else
+      fprintf(stderr, "%s: %s\n", T->cond ? "[[" : "test", msg);
+  }
+  T->err = 1;
+}
+
+/* stat() or lstat() path, reusing an earlier result for the same path in this command */
+static int cached_stat(test_ctx_t *T, const char *path, int link, struct stat **st) {
+  for (int i = 0; i < T->nstats; i++) {
+    stat_entry_t *e = &T->stats[i];
+    if (e->link == link && strcmp(e->path, path) == 0) {
+      *st = &e->st;
+      return e->rc;
+    }
+  }
+  // When the cache is full the first slot is recycled
+  stat_entry_t *e = &T->stats[T->nstats < STAT_CACHE ? T->nstats++ : 0];
+  e->path = path;
+  e->link = link;
+  e->rc = link ? lstat(path, &e->st) : stat(path, &e->st);
+  *st = &e->st;
+  return e->rc;
+}
+
+/* Word i as an operand: expanded (and kept for the command's lifetime) for [[ */
+static const char *operand(test_ctx_t *T, int i, int pattern) {
+  if (T->skip) return "";
+  if (!T->cond) return T->av[i];
+  if (!T->owned[i]) T->owned[i] = pattern ? expand_pattern(T->av[i]) : expand_word(T->av[i]);
+  return T->owned[i];
+}
+
+static const char *peek(test_ctx_t *T, int off) {
+  int i = T->pos + off;
+  return i < T->ac ? T->av[i] : NULL;
+}
+
+static int is_unary_op(const char *w) {
+  return w && w[0] == '-' && w[1] && !w[2] && strchr("bcdefghLprsStuwxkOGnz", w[1]);
+}
+
+static int is_binary_op(test_ctx_t *T, const char *w) {
+  static const char *ops[] = {"=",   "==",  "!=",  "<",   ">",   "-eq", "-ne", "-lt", "-le",
+                              "-gt", "-ge", "-nt", "-ot", "-ef", "=~",  NULL};
+  if (!w) return 0;
+  for (int i = 0; ops[i]; i++) {
+    if (strcmp(w, ops[i]) == 0) return T->cond || strcmp(w, "=~") != 0;
+  }
+  return 0;
+}
+
+static long to_integer(test_ctx_t *T, const char *s) {
+  char *end;
+  errno = 0;
+  long v = strtol(s, &end, 10);
+  while (*end == ' ' || *end == '\t') end++;
+  if (end == s || *end || errno) test_error(T, "integer expression expected", s);
+  return v;
+}
+
+static int file_test(test_ctx_t *T, char op, const char *path) {
+  if (op == 't') return isatty((int)to_integer(T, path));
+  if (op == 'r') return access(path, R_OK) == 0;
+  if (op == 'w') return access(path, W_OK) == 0;
+  if (op == 'x') return access(path, X_OK) == 0;
+
+  struct stat *st;
+  if (cached_stat(T, path, op == 'h' || op == 'L', &st) != 0) return 0;
+  switch (op) {
+    case 'e':
+      return 1;
+    case 'f':
+      return S_ISREG(st->st_mode);
+    case 'd':
+      return S_ISDIR(st->st_mode);
+    case 'b':
+      return S_ISBLK(st->st_mode);
+    case 'c':
+      return S_ISCHR(st->st_mode);
+    case 'p':
+      return S_ISFIFO(st->st_mode);
+    case 'S':
+      return S_ISSOCK(st->st_mode);
+    case 'h':
+    case 'L':
+      return S_ISLNK(st->st_mode);
+    case 's':
+      return st->st_size > 0;
+    case 'g':
+      return (st->st_mode & S_ISGID) != 0;
+    case 'u':
+      return (st->st_mode & S_ISUID) != 0;
+    case 'k':
+      return (st->st_mode & S_ISVTX) != 0;
+    case 'O':
+      return st->st_uid == geteuid();
+    case 'G':
+      return st->st_gid == getegid();
+    default:
+      return 0;
+  }
+}
+
+static int unary(test_ctx_t *T, const char *op, const char *arg) {
+  if (T->skip) return 0;
+  if (op[1] == 'n') return *arg != '\0';
+  if (op[1] == 'z') return *arg == '\0';
+  return file_test(T, op[1], arg);
+}
+
+/* The last compiled =~ pattern; loops tend to match against the same one */
+static char *last_regex_text;
+static regex_t last_regex;
+
+static int regex_match(test_ctx_t *T, const char *s, const char *re) {
+  if (!last_regex_text || strcmp(last_regex_text, re) != 0) {
+    if (last_regex_text) {
+      regfree(&last_regex);
+      free(last_regex_text);
+      last_regex_text = NULL;
+    }
+    if (regcomp(&last_regex, re, REG_EXTENDED | REG_NOSUB) != 0) {
+      test_error(T, "invalid regular expression", re);
+      return 0;
+    }
+    last_regex_text = strdup(re);
+  }
+  return regexec(&last_regex, s, 0, NULL, 0) == 0;
+}
+
+static int file_compare(test_ctx_t *T, const char *op, const char *a, const char *b) {
+  struct stat *sa, *sb;
+  int ra = cached_stat(T, a, 0, &sa);
+  struct stat copy = *sa;  // the second lookup may reuse the slot
+  int rb = cached_stat(T, b, 0, &sb);
+  if (strcmp(op, "-ef") == 0)
+    return ra == 0 && rb == 0 && copy.st_dev == sb->st_dev && copy.st_ino == sb->st_ino;
+  int newer = strcmp(op, "-nt") == 0;
+  if (ra != 0 || rb != 0) return newer ? ra == 0 : rb == 0;  // a missing file is oldest
+  struct timespec ta = copy.st_mtim, tb = sb->st_mtim;
+  int cmp = ta.tv_sec != tb.tv_sec ? (ta.tv_sec > tb.tv_sec ? 1 : -1)
+                                   : (ta.tv_nsec > tb.tv_nsec) - (ta.tv_nsec < tb.tv_nsec);
+  return newer ? cmp > 0 : cmp < 0;
+}
+
+/* Evaluate av[ia] op av[ia + 2] where op = av[ia + 1] */
+static int binary(test_ctx_t *T, int ia) {
+  if (T->skip) return 0;
+  const char *op = T->av[ia + 1];
+  int pattern = T->cond && (strcmp(op, "==") == 0 || strcmp(op, "=") == 0 ||
+                            strcmp(op, "!=") == 0 || strcmp(op, "=~") == 0);
+  const char *a = operand(T, ia, 0);
+  const char *b = operand(T, ia + 2, pattern);
+
+  if (strcmp(op, "=~") == 0) return regex_match(T, a, b);
+  if (strcmp(op, "=") == 0 || strcmp(op, "==") == 0)
+    return pattern ? fnmatch(b, a, 0) == 0 : strcmp(a, b) == 0;
+  if (strcmp(op, "!=") == 0) return pattern ? fnmatch(b, a, 0) != 0 : strcmp(a, b) != 0;
+  if (strcmp(op, "<") == 0) return strcmp(a, b) < 0;
+  if (strcmp(op, ">") == 0) return strcmp(a, b) > 0;
+  if (strcmp(op, "-nt") == 0 || strcmp(op, "-ot") == 0 || strcmp(op, "-ef") == 0)
+    return file_compare(T, op, a, b);
+
+  long x = to_integer(T, a), y = to_integer(T, b);
+  if (strcmp(op, "-eq") == 0) return x == y;
+  if (strcmp(op, "-ne") == 0) return x != y;
+  if (strcmp(op, "-lt") == 0) return x < y;
+  if (strcmp(op, "-le") == 0) return x <= y;
+  if (strcmp(op, "-gt") == 0) return x > y;
+  return x >= y;
+}
+
+static int eval_primary(test_ctx_t *T) {
+  const char *w = peek(T, 0);
+  if (!w) {
+    test_error(T, "argument expected", NULL);
+    return 0;
+  }
+  if (strcmp(w, "(") == 0) {
+    T->pos++;
+    int v = eval_or(T);
+    if (!peek(T, 0) || strcmp(peek(T, 0), ")") != 0) {
+      test_error(T, "')' expected", NULL);
+      return 0;
+    }
+    T->pos++;
+    return v;
+  }
+  if (is_binary_op(T, peek(T, 1)) && peek(T, 2)) {
+    int v = binary(T, T->pos);
+    T->pos += 3;
+    return v;
+  }
+  if (is_unary_op(w) && peek(T, 1)) {
+    int v = unary(T, w, operand(T, T->pos + 1, 0));
+    T->pos += 2;
+    return v;
+  }
+  T->pos++;
+  return *operand(T, T->pos - 1, 0) != '\0';
+}
+
+static int eval_not(test_ctx_t *T) {
+  const char *w = peek(T, 0);
+  if (w && strcmp(w, "!") == 0) {
+    T->pos++;
+    return !eval_not(T);
+  }
+  return eval_primary(T);
+}
+
+static int is_word(test_ctx_t *T, const char *w) {
+  return peek(T, 0) && strcmp(peek(T, 0), w) == 0;
+}
+
+static int eval_and(test_ctx_t *T) {
+  int v = eval_not(T);
+  while (!T->err && is_word(T, T->cond ? "&&" : "-a")) {
+    T->pos++;
+    int skip = T->skip;
+    T->skip |= !v;
+    int rhs = eval_not(T);
+    T->skip = skip;
+    v = v && rhs;
+  }
+  return v;
+}
+
+static int eval_or(test_ctx_t *T) {
+  int v = eval_and(T);
+  while (!T->err && is_word(T, T->cond ? "||" : "-o")) {
+    T->pos++;
+    int skip = T->skip;
+    T->skip |= v;
+    int rhs = eval_and(T);
+    T->skip = skip;
+    v = v || rhs;
+  }
+  return v;
+}
+
+/* POSIX test with n arguments starting at T->pos; more than 4 uses the full grammar */
+static int eval_posix(test_ctx_t *T, int n) {
+  char **a = T->av + T->pos;
+  switch (n) {
+    case 0:
+      return 0;
+    case 1:
+      T->pos++;
+      return *a[0] != '\0';
+    case 2:
+      if (strcmp(a[0], "!") == 0) {
+        T->pos++;
+        return !eval_posix(T, 1);
+      }
+      if (is_unary_op(a[0])) {
+        T->pos += 2;
+        return unary(T, a[0], a[1]);
+      }
+      test_error(T, "unary operator expected", a[0]);
+      return 0;
+    case 3:
+      if (is_binary_op(T, a[1])) {
+        T->pos += 3;
+        return binary(T, T->pos - 3);
+      }
+      if (strcmp(a[1], "-a") == 0 || strcmp(a[1], "-o") == 0) break;
+      if (strcmp(a[0], "!") == 0) {
+        T->pos++;
+        return !eval_posix(T, 2);
+      }
+      if (strcmp(a[0], "(") == 0 && strcmp(a[2], ")") == 0) {
+        T->pos += 3;
+        return *a[1] != '\0';
+      }
+      break;
+    case 4:
+      if (strcmp(a[0], "!") == 0) {
+        T->pos++;
+        return !eval_posix(T, 3);
+      }
+      if (strcmp(a[0], "(") == 0 && strcmp(a[3], ")") == 0) {
+        T->pos++;
+        int v = eval_posix(T, 2);
+        T->pos++;
+        return v;
+      }
+      break;
+  }
+  return eval_or(T);
+}
+
+static int run(test_ctx_t *T) {
+  int v = T->cond ? eval_or(T) : eval_posix(T, T->ac);
+  if (!T->err && T->pos < T->ac) test_error(T, "too many arguments", T->av[T->pos]);
+  if (T->owned) {
+    for (int i = 0; i < T->ac; i++) free(T->owned[i]);
+    free(T->owned);
+  }
+  return T->err ? 2 : !v;
+}
+
+int builtin_test(char **args) {
+  int n = 0;
+  while (args[n]) n++;
+  if (strcmp(args[0], "[") == 0) {
+    if (strcmp(args[n - 1], "]") != 0) {
+      fprintf(stderr, "[: missing ']'\n");
+      return 2;
+    }
+    n--;
+  }
+  test_ctx_t T = {.av = args + 1, .ac = n - 1};
+  return run(&T);
+}
+
+int builtin_cond(char **words, int count) {
+  if (count < 2 || strcmp(words[count - 1], "]]") != 0) {
+    fprintf(stderr, "[[: missing ']]'\n");
+    return 2;
+  }
+  test_ctx_t T = {.av = words + 1, .ac = count - 2, .cond = 1};
+  if (T.ac == 0) {
+    fprintf(stderr, "[[: expression expected\n");
+    return 2;
+  }
+  T.owned = calloc(T.ac, sizeof(char *));
+  return run(&T);
+}
@@ -1,13 +1,17 @@
 #include "vars.h"
 #include "arith.h"
 #include "shell.h"
+#include "globbing.h"
 #include <string.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <unistd.h>
 #include <sys/wait.h>
+#include <errno.h>
 #include <fcntl.h>
 #include <ctype.h>
+#include <fnmatch.h>
+#include <pwd.h>
 
 /* Weak stub for unit tests (overridden by real implementation in shell.c) */
 __attribute__((weak)) int parse_and_execute(char *input) {
@@ -15,51 +19,171 @@ __attribute__((weak)) int parse_and_execute(char *input) {
   return 0;
 }
 
-typedef struct {
-  char name[MAX_VAR_NAME];
-  char value[MAX_VAR_VALUE];
-  int in_use;
+/* Exit status of the last command ($?); the real one lives in shell.c */
+__attribute__((weak)) int last_status = 0;
+
+int expansion_failed;
+
+/* In-process command substitution (shell.c); the stub always declines */
+__attribute__((weak)) int capture_in_process(const char *cmd, char **out, size_t *len) {
+  (void)cmd;
+  (void)out;
+  (void)len;
+  return 0;
+}
+
+/*
+ * Variable store: an open-addressing hash table (linear probing, power-of-two size) of
+ * pointers to heap entries. Entries never move once created, names are interned in a
+ * bump arena and values live in growable heap buffers of any length.
+ */
+typedef struct var {
+  const char *name;  // interned, NUL-terminated
+  size_t name_len;
+  unsigned int hash;
+  char *value;
+  size_t len;
+  size_t cap;
+  int exported;
+  long num;       // atol(value), valid while num_valid is set
+  int num_valid;  // cleared whenever the value changes
 } var_t;
 
-static var_t vars[MAX_VARS];
+#define VAR_TABLE_MIN 64
+#define NAME_ARENA_CHUNK 4096
 
-static int find_var(const char *name) {
-  for (int i = 0; i < MAX_VARS; i++) {
-    if (vars[i].in_use && strcmp(vars[i].name, name) == 0) {
-      return i;
-    }
+static var_t **vars;
+static size_t vars_cap;
+static size_t vars_count;
+
+static char *name_arena;
+static size_t name_arena_left;
+
+static unsigned int hash_name(const char *name, size_t len) {
+  unsigned int h = 2166136261u;  // FNV-1a
+  for (size_t i = 0; i < len; i++) {
+    h ^= (unsigned char)name[i];
+    h *= 16777619u;
   }
-  return -1;
+  return h;
 }
 
-void set_var(const char *name, const char *value) {
-  int idx = find_var(name);
-  if (idx == -1) {
-    // find empty slot
-    for (int i = 0; i < MAX_VARS; i++) {
-      if (!vars[i].in_use) {
-        idx = i;
-        vars[i].in_use = 1;
-        strncpy(vars[i].name, name, MAX_VAR_NAME - 1);
-        vars[i].name[MAX_VAR_NAME - 1] = '\0';
-        break;
-      }
+static const char *intern_name(const char *name, size_t len) {
+  if (len + 1 > name_arena_left) {
+    size_t chunk = len + 1 > NAME_ARENA_CHUNK ? len + 1 : NAME_ARENA_CHUNK;
+    name_arena = malloc(chunk);
+    if (!name_arena) {
+      perror("malloc");
+      exit(EXIT_FAILURE);
     }
+    name_arena_left = chunk;
   }
-  if (idx != -1) {
-    strncpy(vars[idx].value, value, MAX_VAR_VALUE - 1);
-    vars[idx].value[MAX_VAR_VALUE - 1] = '\0';
-  } else {
-    fprintf(stderr, "Variable table full\n");
+  char *s = name_arena;
+  memcpy(s, name, len);
+  s[len] = '\0';
+  name_arena += len + 1;
+  name_arena_left -= len + 1;
+  return s;
+}
+
+static void grow_table(void) {
+  size_t new_cap = vars_cap ? vars_cap * 2 : VAR_TABLE_MIN;
+  var_t **new_vars = calloc(new_cap, sizeof(var_t *));
+  if (!new_vars) {
+    perror("calloc");
+    exit(EXIT_FAILURE);
+  }
+  for (size_t i = 0; i < vars_cap; i++) {
+    var_t *v = vars[i];
+    if (!v) continue;
+    size_t j = v->hash & (new_cap - 1);
+    while (new_vars[j]) j = (j + 1) & (new_cap - 1);
+    new_vars[j] = v;
+  }
+  free(vars);
+  vars = new_vars;
+  vars_cap = new_cap;
+}
+
+/* Look up a variable by (name, len); creates the entry when create is set */
+static var_t *find_var(const char *name, size_t len, int create) {
+  if (vars_cap == 0 || (create && (vars_count + 1) * 10 > vars_cap * 7)) {
+    if (!create) return NULL;
+    grow_table();
+  }
+  unsigned int h = hash_name(name, len);
+  size_t i = h & (vars_cap - 1);
+  while (vars[i]) {
+    var_t *v = vars[i];
+    if (v->hash == h && v->name_len == len && memcmp(v->name, name, len) == 0) return v;
+    i = (i + 1) & (vars_cap - 1);
   }
+  if (!create) return NULL;
+
+  var_t *v = calloc(1, sizeof(var_t));
+  if (!v) {
+    perror("calloc");
+    exit(EXIT_FAILURE);
+  }
+  v->name = intern_name(name, len);
+  v->name_len = len;
+  v->hash = h;
+  vars[i] = v;
+  vars_count++;
+  return v;
+}
+
+static void assign_var(var_t *v, const char *value) {
+  size_t len = strlen(value);
+  if (len + 1 > v->cap) {
+    size_t cap = v->cap ? v->cap : 16;
+    while (cap < len + 1) cap *= 2;
+    char *buf = realloc(v->value, cap);
+    if (!buf) {
+      perror("realloc");
+      return;
+    }
+    v->value = buf;
+    v->cap = cap;
+  }
+  memcpy(v->value, value, len + 1);
+  v->len = len;
+  v->num_valid = 0;
+  if (v->exported) setenv(v->name, v->value, 1);
+}
+
+void set_var(const char *name, const char *value) {
+  assign_var(find_var(name, strlen(name), 1), value);
 }
 
 const char *get_var(const char *name) {
-  int idx = find_var(name);
-  if (idx != -1) {
-    return vars[idx].value;
+  return get_var_n(name, strlen(name));
+}
+
+const char *get_var_n(const char *name, size_t len) {
+  var_t *v = find_var(name, len, 0);
+  return (v && v->value) ? v->value : NULL;
+}
+
+struct var *var_slot(const char *name, size_t len) {
+  return find_var(name, len, 1);
+}
+
+long var_slot_number(struct var *v) {
+  if (!v->value) return 0;
+  if (!v->num_valid) {
+    v->num = atol(v->value);
+    v->num_valid = 1;
   }
-  return NULL;
+  return v->num;
+}
+
+void var_slot_set_number(struct var *v, long n) {
+  char buf[32];
+  snprintf(buf, sizeof(buf), "%ld", n);
+  if (!v->value || strcmp(v->value, buf) != 0) assign_var(v, buf);
+  v->num = n;
+  v->num_valid = 1;
 }
 
 /**
@@ -67,24 +191,53 @@ const char *get_var(const char *name) {
  * If the variable is not defined, returns -1. Otherwise, calls setenv() and returns its result.
  */
 int export_var(const char *name) {
-  const char *val = get_var(name);
-  if (!val) {
+  var_t *v = find_var(name, strlen(name), 0);
+  if (!v || !v->value) {
     return -1;
   }
-  return setenv(name, val, 1); /* overwrite = 1 */
+  v->exported = 1; /* later set_var() calls keep the environment in sync */
+  return setenv(name, v->value, 1); /* overwrite = 1 */
 }
 
 /**
  * Execute a command and capture its output
  * Returns a newly allocated string with the command output or NULL on failure
  */
-char *capture_command_output(const char *cmd) {
+/*
+ * Shape raw substitution output in place: NUL bytes cannot live in a shell word and are
+ * dropped, and every trailing newline is removed. Returns the new length.
+ */
+static size_t finish_capture(char *buf, size_t len) {
+  char *nul = memchr(buf, '\0', len);
+  if (nul) {
+    char *dst = nul;
+    for (const char *src = nul; src < buf + len; src++)
+      if (*src) *dst++ = *src;
+    len = dst - buf;
+  }
+  while (len > 0 && buf[len - 1] == '\n') len--;
+  buf[len] = '\0';
+  return len;
+}
+
+#define CAPTURE_CHUNK 65536
+
+char *capture_command_output(const char *cmd, size_t *out_len) {
+  // Built-ins and functions run without forking when that is unobservable
+  char *fast;
+  size_t fast_len;
+  if (capture_in_process(cmd, &fast, &fast_len)) {
+    *out_len = finish_capture(fast, fast_len);
+    return fast;
+  }
+
   int pipefd[2];
   if (pipe(pipefd) == -1) {
     perror("pipe");
     return NULL;
   }
 
+  fflush(stdout);  // don't let the child inherit unflushed output
   pid_t pid = fork();
   if (pid == -1) {
     perror("fork");
@@ -114,270 +267,687 @@ char *capture_command_output(const char *cmd) {
     close(pipefd[1]);
 
     // Execute the command
-    parse_and_execute((char *)cmd);
-    exit(EXIT_SUCCESS);
-  } else {
-    /* parent */
-    close(pipefd[1]);  // Close write end
+    int rc = parse_and_execute((char *)cmd);
+    fflush(stdout);
+    _exit(rc);
+  }
 
-    // Read from pipe
-    char buffer[4096];
-    ssize_t bytes_read;
-    size_t total_size = 0;
-    size_t buffer_size = 4096;
-    char *output = malloc(buffer_size);
+  /* parent */
+  close(pipefd[1]);  // Close write end
 
-    if (!output) {
-      perror("malloc");
-      close(pipefd[0]);
-      return NULL;
+  // Read straight into the output buffer at a tracked offset; it grows geometrically so
+  // the whole capture is linear in the output size
+  size_t total_size = 0;
+  size_t buffer_size = CAPTURE_CHUNK;
+  char *output = malloc(buffer_size);
+  if (!output) {
+    perror("malloc");
+    close(pipefd[0]);
+    waitpid(pid, NULL, 0);
+    return NULL;
+  }
+
+  for (;;) {
+    if (buffer_size - total_size < CAPTURE_CHUNK / 2 + 1) {
+      buffer_size *= 2;
+      char *new_output = realloc(output, buffer_size);
+      if (!new_output) {
+        perror("realloc");
+        break;  // keep what was read; the child still gets reaped below
+      }
+      output = new_output;
     }
+    ssize_t bytes_read = read(pipefd[0], output + total_size, buffer_size - total_size - 1);
+    if (bytes_read < 0 && errno == EINTR) continue;
+    if (bytes_read <= 0) break;
+    total_size += bytes_read;
+  }
 
-    output[0] = '\0';
+  close(pipefd[0]);
 
-    while ((bytes_read = read(pipefd[0], buffer, sizeof(buffer) - 1)) > 0) {
-      buffer[bytes_read] = '\0';
+  // Wait for child to finish
+  int status;
+  while (waitpid(pid, &status, 0) == -1 && errno == EINTR) {
+  }
+  last_status = WIFEXITED(status) ? WEXITSTATUS(status) : 128 + WTERMSIG(status);
 
-      // Ensure output buffer is large enough
-      if (total_size + bytes_read + 1 > buffer_size) {
-        buffer_size *= 2;
-        char *new_output = realloc(output, buffer_size);
-        if (!new_output) {
-          perror("realloc");
-          free(output);
-          close(pipefd[0]);
-          return NULL;
-        }
-        output = new_output;
-      }
+  *out_len = finish_capture(output, total_size);
+  return output;
+}
 
-      // Append to output
-      strcat(output, buffer);
-      total_size += bytes_read;
-    }
+// ---------------- Word expansion ------------------
+/*
+ * Every word is walked once, left to right. Tilde, parameter, command and arithmetic
+ * expansion happen as they are met and append into growable field buffers; field
+ * splitting and pathname expansion are applied to the results as they are appended, and
+ * quote removal falls out of the walk. Each output field costs one buffer allocation.
+ */
 
-    close(pipefd[0]);
+typedef struct {
+  char *data;
+  size_t len;
+  size_t cap;
+} strbuf_t;
+
+static void sb_putc(strbuf_t *b, char c) {
+  if (b->len + 2 > b->cap) {
+    b->cap = b->cap ? b->cap * 2 : 32;
+    b->data = realloc(b->data, b->cap);
+  }
+  b->data[b->len++] = c;
+  b->data[b->len] = '\0';
+}
 
-    // Wait for child to finish
-    int status;
-    waitpid(pid, &status, 0);
+typedef struct {
+  strbuf_t cur;   // current field, quotes removed
+  strbuf_t pat;   // same field with quoted pattern characters backslash-escaped
+  int has_glob;   // current field contains an unquoted * ? or [
+  int started;    // current field exists even when empty ("" or '')
+  int split;      // field splitting and pathname expansion enabled
+  const char *ifs;
+  char **fields;  // finished fields (split mode only)
+  int nfields;
+  int cap;
+} expander_t;
+
+static void expand_into(expander_t *E, const char *word);
+
+static int is_name_start(int c) {
+  return isalpha((unsigned char)c) || c == '_';
+}
 
-    // Remove trailing newline if present
-    if (total_size > 0 && output[total_size - 1] == '\n') {
-      output[total_size - 1] = '\0';
-    }
+static int is_name_char(int c) {
+  return isalnum((unsigned char)c) || c == '_';
+}
+
+static void emit_quoted(expander_t *E, char c) {
+  sb_putc(&E->cur, c);
+  if (c == '*' || c == '?' || c == '[' || c == ']' || c == '\\') sb_putc(&E->pat, '\\');
+  sb_putc(&E->pat, c);
+}
 
-    return output;
+static void emit_literal(expander_t *E, char c) {
+  sb_putc(&E->cur, c);
+  sb_putc(&E->pat, c);
+  if (c == '*' || c == '?' || c == '[') E->has_glob = 1;
+}
+
+static void push_field(expander_t *E, char *s) {
+  if (E->nfields + 2 > E->cap) {
+    E->cap = E->cap ? E->cap * 2 : 8;
+    E->fields = realloc(E->fields, E->cap * sizeof(char *));
   }
+  E->fields[E->nfields++] = s;
+  E->fields[E->nfields] = NULL;
 }
 
-/**
- * Expand command substitution $(command) or `command` in the given string
- * Returns a newly allocated string with substitutions performed or NULL if no substitution
- */
-char *expand_cmd_subst(const char *arg) {
-  if (!arg || (strstr(arg, "$(") == NULL && strchr(arg, '`') == NULL)) return NULL;
-
-  char *result = strdup(arg);
-  if (!result) return NULL;
-
-  // Handle $(command) syntax
-  char *start;
-  while ((start = strstr(result, "$(")) != NULL) {
-    // Find the matching closing parenthesis
-    int depth = 1;
-    char *end = start + 2;
-    while (*end && depth > 0) {
-      if (*end == '(')
-        depth++;
-      else if (*end == ')')
-        depth--;
-      if (depth > 0) end++;
-    }
+static void reset_field(expander_t *E) {
+  E->cur.len = E->pat.len = 0;
+  if (E->cur.data) E->cur.data[0] = '\0';
+  if (E->pat.data) E->pat.data[0] = '\0';
+  E->has_glob = 0;
+  E->started = 0;
+}
 
-    if (depth != 0 || !*end) {
-      // Unmatched parenthesis
-      fprintf(stderr, "Syntax error: unmatched $(\n");
-      free(result);
-      return NULL;
-    }
+/* End the current field, globbing it if it holds unquoted pattern characters */
+static void finish_field(expander_t *E) {
+  if (E->cur.len == 0 && !E->started) return;
+  char **matches = NULL;
+  int count = 0;
+  if (E->has_glob) matches = glob_pattern(E->pat.data, &count);
+  if (matches) {
+    for (int i = 0; i < count; i++) push_field(E, matches[i]);
+    free(matches);
+  } else {
+    push_field(E, strndup(E->cur.data ? E->cur.data : "", E->cur.len));
+  }
+  reset_field(E);
+}
 
-    // Extract the command
-    size_t cmd_len = end - (start + 2);
-    char *cmd = malloc(cmd_len + 1);
-    if (!cmd) {
-      free(result);
-      return NULL;
+/* Append the result of an expansion; unquoted results are split on IFS */
+static void emit_expansion(expander_t *E, const char *s, size_t n, int quoted) {
+  for (size_t i = 0; i < n; i++) {
+    if (quoted) {
+      emit_quoted(E, s[i]);
+    } else if (E->split && s[i] && strchr(E->ifs, s[i])) {
+      finish_field(E);
+    } else {
+      emit_literal(E, s[i]);
     }
-    strncpy(cmd, start + 2, cmd_len);
-    cmd[cmd_len] = '\0';
+  }
+}
+
+/* Expand a nested word (operand of ${...} or $((...))) to a single string */
+static char *expand_nested(const char *s, size_t n) {
+  char *tmp = strndup(s, n);
+  char *out = expand_word(tmp);
+  free(tmp);
+  return out;
+}
 
-    // Execute the command and capture output
-    char *cmd_output = capture_command_output(cmd);
-    free(cmd);
+static int positional_count(void) {
+  char num[16];
+  int n = 0;
+  do snprintf(num, sizeof(num), "%d", ++n);
+  while (get_var(num));
+  return n - 1;
+}
 
-    if (!cmd_output) {
-      free(result);
-      return NULL;
+/* $@ / $*: each positional parameter; "$@" keeps them as separate fields */
+static void emit_positional(expander_t *E, int quoted, int separate) {
+  int n = positional_count();
+  char num[16];
+  for (int i = 1; i <= n; i++) {
+    snprintf(num, sizeof(num), "%d", i);
+    const char *v = get_var(num);
+    if (i > 1) {
+      if (quoted && separate) {
+        E->started = 1;
+        finish_field(E);
+      } else {
+        emit_expansion(E, " ", 1, quoted);
+      }
     }
+    emit_expansion(E, v, strlen(v), quoted);
+  }
+}
 
-    // Replace $(command) with its output
-    size_t prefix_len = start - result;
-    size_t suffix_len = strlen(end + 1);
-    size_t output_len = strlen(cmd_output);
-    size_t new_len = prefix_len + output_len + suffix_len + 1;
-
-    char *new_result = malloc(new_len);
-    if (!new_result) {
-      free(cmd_output);
-      free(result);
-      return NULL;
+/* Value of a special parameter ($? $$ $# $0 $!) in buf, or NULL */
+static const char *special_param(char c, char *buf, size_t size) {
+  switch (c) {
+    case '?':
+      snprintf(buf, size, "%d", last_status);
+      return buf;
+    case '$':
+      snprintf(buf, size, "%d", (int)getpid());
+      return buf;
+    case '#':
+      snprintf(buf, size, "%d", positional_count());
+      return buf;
+    case '0': {
+      const char *v = get_var("0");
+      return v ? v : "ash";
     }
+    case '!':
+      return get_var("!");
+  }
+  return NULL;
+}
 
-    // Copy parts together
-    strncpy(new_result, result, prefix_len);
-    new_result[prefix_len] = '\0';
-    strcat(new_result, cmd_output);
-    strcat(new_result, end + 1);
-
-    free(cmd_output);
-    free(result);
-    result = new_result;
-  }
-
-  // Handle `command` syntax
-  while ((start = strchr(result, '`')) != NULL) {
-    char *end = strchr(start + 1, '`');
-    if (!end) {
-      // Unmatched backtick
-      fprintf(stderr, "Syntax error: unmatched `\n");
-      free(result);
-      return NULL;
+/* Remove the shortest/longest prefix (#, ##) or suffix (%, %%) matching pattern */
+static char *remove_pattern(const char *val, const char *pattern, char op, int longest) {
+  size_t len = strlen(val);
+  char *tmp = strdup(val);
+  for (size_t k = 0; k <= len; k++) {
+    size_t i = longest ? len - k : k;  // candidate prefix/suffix length
+    if (op == '#') {
+      char saved = tmp[i];
+      tmp[i] = '\0';
+      int m = fnmatch(pattern, tmp, 0) == 0;
+      tmp[i] = saved;
+      if (m) {
+        memmove(tmp, tmp + i, len - i + 1);
+        return tmp;
+      }
+    } else if (fnmatch(pattern, val + len - i, 0) == 0) {
+      tmp[len - i] = '\0';
+      return tmp;
     }
+  }
+  return tmp;
+}
 
-    // Extract the command
-    size_t cmd_len = end - (start + 1);
-    char *cmd = malloc(cmd_len + 1);
-    if (!cmd) {
-      free(result);
-      return NULL;
+/*
+ * Field idx of a word list (space-separated, as PIPESTATUS is stored): sets *len and
+ * returns its start, or NULL past the end. A negative idx counts the fields instead.
+ */
+static const char *list_field(const char *val, long idx, size_t *len) {
+  long count = 0;
+  const char *p = val;
+  for (;;) {
+    while (*p == ' ') p++;
+    if (!*p) break;
+    const char *start = p;
+    while (*p && *p != ' ') p++;
+    if (count++ == idx) {
+      *len = p - start;
+      return start;
     }
-    strncpy(cmd, start + 1, cmd_len);
-    cmd[cmd_len] = '\0';
+  }
+  *len = count;
+  return NULL;
+}
 
-    // Execute the command and capture output
-    char *cmd_output = capture_command_output(cmd);
-    free(cmd);
+/* ${name[i]}, ${name[@]} and ${#name[@]} on a word-list variable */
+static int expand_subscript(expander_t *E, const char *body, size_t n, int quoted) {
+  int count = body[0] == '#';
+  const char *name = body + count;
+  size_t name_len = 0;
+  while (name + name_len < body + n && is_name_char(name[name_len])) name_len++;
+  const char *sub = name + name_len;
+  if (name_len == 0 || !is_name_start(name[0]) || sub >= body + n - 2 || *sub != '[' ||
+      body[n - 1] != ']')
+    return 0;
+  sub++;
+  size_t sub_len = body + n - 1 - sub;
+
+  const char *val = get_var_n(name, name_len);
+  int is_set = val != NULL;
+  if (!val) val = "";
+  int all = sub_len == 1 && (*sub == '@' || *sub == '*');
+  char *end;
+  long idx = all ? -1 : strtol(sub, &end, 10);
+  if (!all && (end != sub + sub_len || idx < 0)) {
+    fprintf(stderr, "ash: ${%.*s}: bad array subscript\n", (int)n, body);
+    expansion_failed = 1;
+    return 1;
+  }
 
-    if (!cmd_output) {
-      free(result);
-      return NULL;
-    }
+  // Only PIPESTATUS is a word list; any other variable is a one-element array, as in bash
+  int list = name_len == 10 && memcmp(name, "PIPESTATUS", 10) == 0;
+  size_t len = strlen(val);
+  const char *field = all ? NULL : list ? list_field(val, idx, &len) : idx == 0 ? val : NULL;
+  if (count) {
+    char num[32];
+    if (all && list) list_field(val, -1, &len);
+    else if (all) len = is_set;
+    else if (!field) len = 0;
+    snprintf(num, sizeof(num), "%zu", len);
+    emit_expansion(E, num, strlen(num), quoted);
+  } else if (all) {
+    emit_expansion(E, val, strlen(val), quoted);
+  } else if (field) {
+    emit_expansion(E, field, len, quoted);
+  }
+  return 1;
+}
+
+/* ${...}: body points just past "${", n is the length up to the closing brace */
+static void expand_braced(expander_t *E, const char *body, size_t n, int quoted) {
+  char buf[32];
+  if (n > 3 && body[n - 1] == ']' && expand_subscript(E, body, n, quoted)) return;
+  if (n > 1 && body[0] == '#') {  // ${#name}
+    const char *v = (n == 2 && special_param(body[1], buf, sizeof(buf)))
+                        ? special_param(body[1], buf, sizeof(buf))
+                        : get_var_n(body + 1, n - 1);
+    char num[32];
+    snprintf(num, sizeof(num), "%zu", v ? strlen(v) : (size_t)0);
+    emit_expansion(E, num, strlen(num), quoted);
+    return;
+  }
+
+  size_t name_len = 0;
+  if (n > 0 && is_name_start(body[0])) {
+    while (name_len < n && is_name_char(body[name_len])) name_len++;
+  } else if (n > 0 && isdigit((unsigned char)body[0])) {
+    while (name_len < n && isdigit((unsigned char)body[name_len])) name_len++;
+  } else if (n > 0) {
+    name_len = 1;
+  }
+  if (name_len == 0) {
+    fprintf(stderr, "ash: ${}: bad substitution\n");
+    expansion_failed = 1;
+    return;
+  }
 
-    // Replace `command` with its output
-    size_t prefix_len = start - result;
-    size_t suffix_len = strlen(end + 1);
-    size_t output_len = strlen(cmd_output);
-    size_t new_len = prefix_len + output_len + suffix_len + 1;
-
-    char *new_result = malloc(new_len);
-    if (!new_result) {
-      free(cmd_output);
-      free(result);
-      return NULL;
+  const char *val;
+  if (name_len == 1 && (body[0] == '@' || body[0] == '*')) {
+    if (name_len == n) {
+      emit_positional(E, quoted, body[0] == '@');
+      return;
     }
+    val = NULL;
+  } else if (name_len == 1 && !is_name_char(body[0])) {
+    val = special_param(body[0], buf, sizeof(buf));
+  } else {
+    val = get_var_n(body, name_len);
+  }
 
-    // Copy parts together
-    strncpy(new_result, result, prefix_len);
-    new_result[prefix_len] = '\0';
-    strcat(new_result, cmd_output);
-    strcat(new_result, end + 1);
+  const char *op = body + name_len;
+  size_t rest = n - name_len;
+  if (rest == 0) {
+    if (val) emit_expansion(E, val, strlen(val), quoted);
+    return;
+  }
 
-    free(cmd_output);
-    free(result);
-    result = new_result;
+  int colon = (*op == ':');
+  if (colon) {
+    op++;
+    rest--;
+  }
+  if (rest == 0) {
+    fprintf(stderr, "ash: ${%.*s}: bad substitution\n", (int)n, body);
+    expansion_failed = 1;
+    return;
+  }
+  char kind = *op;
+  const char *word = op + 1;
+  size_t word_len = rest - 1;
+  int unset = (val == NULL) || (colon && *val == '\0');
+
+  switch (kind) {
+    case '-':
+    case '=':
+    case '?':
+      if (unset) {
+        char *w = expand_nested(word, word_len);
+        if (kind == '=') {
+          char *name = strndup(body, name_len);
+          set_var(name, w);
+          free(name);
+        } else if (kind == '?') {
+          fprintf(stderr, "ash: %.*s: %s\n", (int)name_len, body, *w ? w : "parameter not set");
+          free(w);
+          return;
+        }
+        emit_expansion(E, w, strlen(w), quoted);
+        free(w);
+      } else {
+        emit_expansion(E, val, strlen(val), quoted);
+      }
+      return;
+    case '+':
+      if (!unset) {
+        char *w = expand_nested(word, word_len);
+        emit_expansion(E, w, strlen(w), quoted);
+        free(w);
+      }
+      return;
+    case '#':
+    case '%': {
+      if (colon) break;
+      int longest = word_len > 0 && word[0] == kind;
+      if (longest) {
+        word++;
+        word_len--;
+      }
+      char *tmp = strndup(word, word_len);
+      char *pattern = expand_pattern(tmp);
+      free(tmp);
+      char *res = remove_pattern(val ? val : "", pattern, kind, longest);
+      emit_expansion(E, res, strlen(res), quoted);
+      free(res);
+      free(pattern);
+      return;
+    }
   }
+  fprintf(stderr, "ash: ${%.*s}: bad substitution\n", (int)n, body);
+  expansion_failed = 1;
+}
 
-  return result;
+static size_t match_bracket(const char *s, char open, char close);
+
+/* End of a "..." or `...` region starting at its opening quote, the way the lexer reads it */
+static const char *skip_quoted(const char *p) {
+  char q = *p++;
+  while (*p && *p != q) {
+    if (*p == '\\' && p[1]) {
+      p += 2;
+    } else if (q == '"' && p[0] == '$' && p[1] == '(') {
+      size_t n = match_bracket(p + 2, '(', ')');
+      p = n == (size_t)-1 ? p + strlen(p) : p + 2 + n + 1;
+    } else {
+      p++;
+    }
+  }
+  return *p ? p + 1 : p;
 }
 
-void expand_vars(char **args, int arg_count) {
-  for (int i = 0; i < arg_count; i++) {
-    if (args[i] == NULL) continue;
+/* Length of a $(...) / ${...} body starting just after the opening bracket */
+static size_t match_bracket(const char *s, char open, char close) {
+  int depth = 1;
+  const char *p = s;
+  while (*p) {
+    if (*p == '\\' && p[1]) {
+      p += 2;
+      continue;
+    }
+    if (*p == '\'') {
+      const char *q = strchr(p + 1, '\'');
+      p = q ? q + 1 : p + strlen(p);
+      continue;
+    }
+    if (*p == '"' || *p == '`') {
+      p = skip_quoted(p);
+      continue;
+    }
+    if (p[0] == '$' && p[1] == '(' && open != '(') {
+      size_t n = match_bracket(p + 2, '(', ')');
+      p = n == (size_t)-1 ? p + strlen(p) : p + 2 + n + 1;
+      continue;
+    }
+    if (*p == open) {
+      depth++;
+    } else if (*p == close && --depth == 0) {
+      return p - s;
+    }
+    p++;
+  }
+  return (size_t)-1;
+}
 
-    // Command substitution
-    char *cmd_subst = expand_cmd_subst(args[i]);
-    if (cmd_subst) {
-      free(args[i]);
-      args[i] = cmd_subst;
+static void command_subst(expander_t *E, const char *cmd, size_t n, int quoted) {
+  char *text = strndup(cmd, n);
+  size_t len;
+  char *out = capture_command_output(text, &len);
+  free(text);
+  if (out) {
+    emit_expansion(E, out, len, quoted);
+    free(out);
+  }
+}
+
+/* *pp points at '$'; advances past the expansion */
+static void expand_dollar(expander_t *E, const char **pp, int quoted) {
+  const char *p = *pp + 1;
+  char buf[32];
+
+  if (p[0] == '(' && p[1] == '(') {
+    /* $(( expr )) : find the closing "))" */
+    const char *q = p + 2;
+    int depth = 0;
+    for (; *q; q++) {
+      if (*q == '(') {
+        depth++;
+      } else if (*q == ')') {
+        if (depth == 0 && q[1] == ')') break;
+        depth--;
+      }
+    }
+    if (*q) {
+      char *expr = expand_nested(p + 2, q - (p + 2));
+      int ok;
+      long val = eval_arith(expr, &ok);
+      if (!ok) {
+        fprintf(stderr, "ash: arithmetic syntax error: %s\n", expr);
+        expansion_failed = 1;
+      }
+      free(expr);
+      snprintf(buf, sizeof(buf), "%ld", ok ? val : 0L);
+      emit_expansion(E, buf, strlen(buf), quoted);
+      *pp = q + 2;
+      return;
     }
+  }
 
-    // Arithmetic expansion
-    char *arith = expand_arith_subst(args[i]);
-    if (arith) {
-      free(args[i]);
-      args[i] = arith;
+  if (p[0] == '(' || p[0] == '{') {
+    size_t n = match_bracket(p + 1, p[0], p[0] == '(' ? ')' : '}');
+    if (n == (size_t)-1) {
+      fprintf(stderr, "Syntax error: unmatched %s\n", p[0] == '(' ? "$(" : "${");
+      *pp = p + strlen(p);
+      return;
     }
+    if (p[0] == '(')
+      command_subst(E, p + 1, n, quoted);
+    else
+      expand_braced(E, p + 1, n, quoted);
+    *pp = p + 1 + n + 1;
+    return;
+  }
 
-    // Variable expansion
-    if (strchr(args[i], '$') && args[i][0] != '$') {
-      // Handle embedded variables like prefix$VARsuffix
-      char *result = strdup(args[i]);
-      char *dollar;
+  if (is_name_start(*p)) {
+    const char *end = p;
+    while (is_name_char(*end)) end++;
+    const char *v = get_var_n(p, end - p);
+    if (v) emit_expansion(E, v, strlen(v), quoted);
+    *pp = end;
+    return;
+  }
 
-      while ((dollar = strchr(result, '$')) != NULL && dollar[1] != '(') {
-        // Find the end of the variable name
-        char *end = dollar + 1;
-        while (*end && (isalnum((unsigned char)*end) || *end == '_')) end++;
+  if (isdigit((unsigned char)*p) && *p != '0') {
+    char num[2] = {*p, '\0'};
+    const char *v = get_var(num);
+    if (v) emit_expansion(E, v, strlen(v), quoted);
+    *pp = p + 1;
+    return;
+  }
 
-        // Extract the variable name
-        size_t var_len = end - (dollar + 1);
-        if (var_len == 0) continue;  // Just a $ with no name
+  if (*p == '@' || *p == '*') {
+    emit_positional(E, quoted, *p == '@');
+    *pp = p + 1;
+    return;
+  }
 
-        char var_name[MAX_VAR_NAME];
-        if (var_len >= MAX_VAR_NAME) var_len = MAX_VAR_NAME - 1;
+  const char *v = *p ? special_param(*p, buf, sizeof(buf)) : NULL;
+  if (v || *p == '!') {
+    if (v) emit_expansion(E, v, strlen(v), quoted);
+    *pp = p + 1;
+    return;
+  }
+
+  /* Not an expansion: a literal dollar sign */
+  if (quoted)
+    emit_quoted(E, '$');
+  else
+    emit_literal(E, '$');
+  *pp = p;
+}
 
-        strncpy(var_name, dollar + 1, var_len);
-        var_name[var_len] = '\0';
+/* *pp points at an opening backquote */
+static void expand_backquote(expander_t *E, const char **pp, int quoted) {
+  const char *start = *pp + 1;
+  strbuf_t cmd = {0};
+  const char *p = start;
+  for (; *p && *p != '`'; p++) {
+    if (*p == '\\' && (p[1] == '`' || p[1] == '\\' || p[1] == '$')) p++;
+    sb_putc(&cmd, *p);
+  }
+  if (*p != '`') {
+    fprintf(stderr, "Syntax error: unmatched `\n");
+    free(cmd.data);
+    *pp = p;
+    return;
+  }
+  command_subst(E, cmd.data ? cmd.data : "", cmd.len, quoted);
+  free(cmd.data);
+  *pp = p + 1;
+}
 
-        // Get the variable value
-        const char *value = get_var(var_name);
-        if (!value) value = "";  // Empty string for undefined variables
+static void expand_tilde(expander_t *E, const char **pp) {
+  const char *p = *pp + 1;
+  const char *end = p;
+  while (*end && *end != '/') {
+    if (!is_name_char(*end) && *end != '-' && *end != '.') return;  // not a plain login name
+    end++;
+  }
+  const char *home = NULL;
+  if (end == p) {
+    home = get_var("HOME");
+    if (!home) home = getenv("HOME");
+  } else {
+    char *user = strndup(p, end - p);
+    struct passwd *pw = getpwnam(user);
+    free(user);
+    if (pw) home = pw->pw_dir;
+  }
+  if (!home) return;
+  for (const char *h = home; *h; h++) emit_quoted(E, *h);
+  *pp = end;
+}
 
-        // Replace $VAR with its value
-        size_t prefix_len = dollar - result;
-        size_t suffix_len = strlen(end);
-        size_t value_len = strlen(value);
-        size_t new_len = prefix_len + value_len + suffix_len + 1;
+static int is_bare_at(const char *s, size_t n) {
+  return (n == 2 && memcmp(s, "$@", 2) == 0) || (n == 4 && memcmp(s, "${@}", 4) == 0);
+}
 
-        char *new_result = malloc(new_len);
-        if (!new_result) {
-          free(result);
-          return;
+static void expand_into(expander_t *E, const char *word) {
+  const char *p = word;
+  if (*p == '~') expand_tilde(E, &p);
+  while (*p) {
+    char c = *p;
+    if (c == '\\') {
+      if (p[1]) emit_quoted(E, p[1]);
+      p += p[1] ? 2 : 1;
+    } else if (c == '\'') {
+      E->started = 1;
+      for (p++; *p && *p != '\''; p++) emit_quoted(E, *p);
+      if (*p) p++;
+    } else if (c == '"') {
+      int was_started = E->started;
+      const char *body = p + 1;
+      E->started = 1;
+      for (p++; *p && *p != '"';) {
+        if (*p == '\\' && p[1] && strchr("$`\"\\", p[1])) {
+          emit_quoted(E, p[1]);
+          p += 2;
+        } else if (*p == '$') {
+          expand_dollar(E, &p, 1);
+        } else if (*p == '`') {
+          expand_backquote(E, &p, 1);
+        } else {
+          emit_quoted(E, *p++);
         }
+      }
+      // "$@" with no positional parameters is no field at all, not an empty one
+      if (!was_started && E->cur.len == 0 && is_bare_at(body, p - body) && !get_var("1"))
+        E->started = 0;
+      if (*p) p++;
+    } else if (c == '$') {
+      expand_dollar(E, &p, 0);
+    } else if (c == '`') {
+      expand_backquote(E, &p, 0);
+    } else {
+      emit_literal(E, c);
+      p++;
+    }
+  }
+}
 
-        // Copy parts together
-        strncpy(new_result, result, prefix_len);
-        new_result[prefix_len] = '\0';
-        strcat(new_result, value);
-        strcat(new_result, end);
+char **expand_words(char **words, int count, int *out_count) {
+  expander_t E = {0};
+  E.split = 1;
+  E.ifs = get_var("IFS");
+  if (!E.ifs) E.ifs = " \t\n";
+  for (int i = 0; i < count; i++) {
+    expand_into(&E, words[i]);
+    finish_field(&E);
+  }
+  free(E.cur.data);
+  free(E.pat.data);
+  if (!E.fields) E.fields = calloc(1, sizeof(char *));
+  if (out_count) *out_count = E.nfields;
+  return E.fields;
+}
 
-        free(result);
-        result = new_result;
-      }
+char *expand_word(const char *word) {
+  expander_t E = {0};
+  expand_into(&E, word);
+  free(E.pat.data);
+  return E.cur.data ? E.cur.data : strdup("");
+}
 
-      free(args[i]);
-      args[i] = result;
-    } else if (args[i][0] == '$' && args[i][1] != '(') {
-      // Simple case: entire argument is a variable reference
-      const char *val = get_var(args[i] + 1);
-      if (val) {
-        free(args[i]);
-        args[i] = strdup(val);
-      } else {
-        free(args[i]);
-        args[i] = strdup("");
-      }
-    }
+char *expand_pattern(const char *word) {
+  expander_t E = {0};
+  expand_into(&E, word);
+  free(E.cur.data);
+  return E.pat.data ? E.pat.data : strdup("");
+}
+
+void expand_vars(char **args, int arg_count) {
+  for (int i = 0; i < arg_count; i++) {
+    // Words without quotes or expansions are left untouched (and unreallocated)
+    if (args[i] == NULL || !strpbrk(args[i], "$`'\"\\~")) continue;
+    char *expanded = expand_word(args[i]);
+    free(args[i]);
+    args[i] = expanded;
   }
 }
@@ -0,0 +1,92 @@
+#include <assert.h>
+#include <limits.h>
+#include <stdio.h>
+#include <string.h>
+#include "arith.h"
+#include "vars.h"
+
+int main(void) {
+  int ok;
+  assert(eval_arith("1 + 2 * 3", &ok) == 7 && ok);
+  assert(eval_arith("(1 + 2) * 3", &ok) == 9 && ok);
+  assert(eval_arith("17 % 5 - -3", &ok) == 5 && ok);
+  assert(eval_arith("-7 / 2", &ok) == -3 && ok);
+  assert(eval_arith("-7 % 2", &ok) == -1 && ok);
+
+  /* comparisons and logic */
+  assert(eval_arith("3 < 4", &ok) == 1 && ok);
+  assert(eval_arith("3 <= 3", &ok) == 1 && ok);
+  assert(eval_arith("4 > 5", &ok) == 0 && ok);
+  assert(eval_arith("2 >= 3", &ok) == 0 && ok);
+  assert(eval_arith("2 == 2", &ok) == 1 && ok);
+  assert(eval_arith("2 != 2", &ok) == 0 && ok);
+  assert(eval_arith("1 < 2 == 1", &ok) == 1 && ok);
+  assert(eval_arith("!0 + !7", &ok) == 1 && ok);
+  assert(eval_arith("1 && 0", &ok) == 0 && ok);
+  assert(eval_arith("0 || 3", &ok) == 1 && ok);
+
+  /* bitwise operators and shifts */
+  assert(eval_arith("~5", &ok) == -6 && ok);
+  assert(eval_arith("6 & 3", &ok) == 2 && ok);
+  assert(eval_arith("6 | 3", &ok) == 7 && ok);
+  assert(eval_arith("6 ^ 3", &ok) == 5 && ok);
+  assert(eval_arith("5 & 3 == 3", &ok) == 1 && ok); /* == binds tighter than & */
+  assert(eval_arith("1 << 4", &ok) == 16 && ok);
+  assert(eval_arith("-16 >> 2", &ok) == -4 && ok);
+
+  /* ?: and the comma operator */
+  assert(eval_arith("1 ? 2 : 3", &ok) == 2 && ok);
+  assert(eval_arith("0 ? 1 : 0 ? 5 : 6", &ok) == 6 && ok);
+  assert(eval_arith("1, 2, 3", &ok) == 3 && ok);
+  assert(eval_arith("x = 3, x * 2", &ok) == 6 && ok);
+
+  /* the side not taken by && || ?: is not evaluated */
+  eval_arith("0 && (q = 1)", &ok);
+  eval_arith("1 || (q = 1)", &ok);
+  eval_arith("1 ? 5 : (q = 1)", &ok);
+  assert(get_var("q") == NULL);
+
+  /* hex and octal constants */
+  assert(eval_arith("0x1F + 0XfF", &ok) == 286 && ok);
+  assert(eval_arith("010", &ok) == 8 && ok);
+  eval_arith("08", &ok);
+  assert(!ok);
+
+  /* 64-bit two's complement wrap-around */
+  assert(eval_arith("9223372036854775807 + 1", &ok) == LONG_MIN && ok);
+  assert(eval_arith("-9223372036854775807 - 1 - 1", &ok) == LONG_MAX && ok);
+  assert(eval_arith("9223372036854775807 * 2", &ok) == -2 && ok);
+  assert(eval_arith("1 << 63", &ok) == LONG_MIN && ok);
+  assert(eval_arith("(-9223372036854775807 - 1) / -1", &ok) == LONG_MIN && ok);
+  assert(eval_arith("(-9223372036854775807 - 1) % -1", &ok) == 0 && ok);
+
+  /* errors: syntax, division by zero */
+  eval_arith("1 +", &ok);
+  assert(!ok);
+  eval_arith("4 / 0", &ok);
+  assert(!ok);
+
+  /* unset and empty variables count as 0, also when assigned to */
+  assert(eval_arith("nosuch + 1", &ok) == 1 && ok);
+  assert(eval_arith("n += 1", &ok) == 1 && ok);
+  assert(strcmp(get_var("n"), "1") == 0);
+  assert(eval_arith("m++", &ok) == 0 && ok);
+  assert(strcmp(get_var("m"), "1") == 0);
+  set_var("e", "");
+  assert(eval_arith("++e", &ok) == 1 && ok);
+
+  /* a cached expression sees later variable changes */
+  set_var("i", "1");
+  assert(eval_arith("i + 1", &ok) == 2 && ok);
+  set_var("i", "41");
+  assert(eval_arith("i + 1", &ok) == 42 && ok);
+  char buf[32];
+  for (int n = 0; n < 1000; n++) {
+    snprintf(buf, sizeof(buf), "i * %d", n);
+    assert(eval_arith(buf, &ok) == 41L * n && ok);
+  }
+  assert(eval_arith("i + 1", &ok) == 42 && ok);
+
+  printf("test_arith: all tests passed\n");
+  return 0;
+}
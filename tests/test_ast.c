@@ -0,0 +1,43 @@
+#include <assert.h>
+#include <stdio.h>
+#include <string.h>
+#include "parser.h"
+
+int main(void)
+{
+  int ok = 0;
+  ASTNode *tree = parse_string("a 'b c' | d && e\n"
+                               "while x; do y; done\n"
+                               "case $v in a|b) z ;; esac\n",
+                               &ok);
+  assert(ok && tree);
+
+  /* a 'b c' | d && e */
+  assert(tree->type == NODE_AND_OR && (tree->flags & NODE_AND));
+  ASTNode *pl = tree->cond;
+  assert(pl->type == NODE_PIPELINE);
+  assert(pl->body->type == NODE_COMMAND && pl->body->argc == 2);
+  assert(strcmp(pl->body->argv[1], "'b c'") == 0); /* words stay verbatim until expansion */
+  assert(pl->body->next && strcmp(pl->body->next->argv[0], "d") == 0);
+  assert(tree->body->type == NODE_COMMAND && strcmp(tree->body->argv[0], "e") == 0);
+
+  /* while loop body is pre-tokenized */
+  ASTNode *loop = tree->next;
+  assert(loop && loop->type == NODE_WHILE);
+  assert(strcmp(loop->cond->argv[0], "x") == 0);
+  assert(strcmp(loop->body->argv[0], "y") == 0);
+
+  /* case with alternative patterns */
+  ASTNode *cs = loop->next;
+  assert(cs && cs->type == NODE_CASE && strcmp(cs->var_name, "$v") == 0);
+  assert(cs->body->type == NODE_CASE_ITEM);
+  assert(strcmp(cs->body->for_list[1], "b") == 0);
+  free_ast(tree);
+
+  /* syntax errors are reported, not executed */
+  tree = parse_string("if true; then echo x\n", &ok);
+  assert(!ok && tree == NULL);
+
+  printf("test_ast: all tests passed\n");
+  return 0;
+}
@@ -0,0 +1,91 @@
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "builtins.h"
+#include "jobs.h"
+#include "vars.h"
+
+/* Job control and the startup profile live in shell.c, which is not linked here */
+void continue_job(job_t *job, int foreground) {
+  (void)job;
+  (void)foreground;
+}
+
+void profile_finish(void) {}
+
+static char out[4096];
+
+/* Run a built-in with input on stdin; its output is left in out, its status returned */
+static int run(const char *input, char **args) {
+  FILE *in = tmpfile(), *cap = tmpfile();
+  fputs(input, in);
+  rewind(in);
+  fflush(stdout);
+  int saved_in = dup(STDIN_FILENO), saved_out = dup(STDOUT_FILENO);
+  dup2(fileno(in), STDIN_FILENO);
+  dup2(fileno(cap), STDOUT_FILENO);
+  int status = find_builtin(args[0])->run(args);
+  fflush(stdout);
+  dup2(saved_in, STDIN_FILENO);
+  dup2(saved_out, STDOUT_FILENO);
+  close(saved_in);
+  close(saved_out);
+  rewind(cap);
+  size_t n = fread(out, 1, sizeof(out) - 1, cap);
+  out[n] = '\0';
+  fclose(in);
+  fclose(cap);
+  return status;
+}
+
+int main(void) {
+  /* echo: -n drops the newline, -e interprets escapes, anything else is output */
+  assert(run("", (char *[]){"echo", "a", "b", NULL}) == 0 && strcmp(out, "a b\n") == 0);
+  run("", (char *[]){"echo", "-n", "a", NULL});
+  assert(strcmp(out, "a") == 0);
+  run("", (char *[]){"echo", "a\\tb", NULL});
+  assert(strcmp(out, "a\\tb\n") == 0);
+  run("", (char *[]){"echo", "-e", "a\\tb\\0101\\c", "never", NULL});
+  assert(strcmp(out, "a\tbA") == 0);
+  run("", (char *[]){"echo", "-ne", "x\\n", NULL});
+  assert(strcmp(out, "x\n") == 0);
+  run("", (char *[]){"echo", "-x", "-n", NULL});
+  assert(strcmp(out, "-x -n\n") == 0);
+
+  /* printf: the format is reused until the arguments run out */
+  run("", (char *[]){"printf", "%s=%d\\n", "a", "1", "b", "2", NULL});
+  assert(strcmp(out, "a=1\nb=2\n") == 0);
+  run("", (char *[]){"printf", "[%s|%s]", "x", "y", "z", NULL});
+  assert(strcmp(out, "[x|y][z|]") == 0);
+  run("", (char *[]){"printf", "%5s|%-3d|%x|%c\\n", "ab", "7", "255", "q", NULL});
+  assert(strcmp(out, "   ab|7  |ff|q\n") == 0);
+  run("", (char *[]){"printf", "\\101%%\\t%b", "1\\n2", NULL});
+  assert(strcmp(out, "A%\t1\n2") == 0);
+  run("", (char *[]){"printf", "%d\\n", "'a", NULL});
+  assert(strcmp(out, "97\n") == 0);
+  assert(run("", (char *[]){"printf", "%d", "zz", NULL}) == 1);
+
+  /* read: IFS splitting, the last name takes the rest, -r keeps backslashes */
+  assert(run("  one two  three four \n", (char *[]){"read", "a", "b", NULL}) == 0);
+  assert(strcmp(get_var("a"), "one") == 0 && strcmp(get_var("b"), "two  three four") == 0);
+  run("x y\n", (char *[]){"read", "a", "b", "c", NULL});
+  assert(strcmp(get_var("b"), "y") == 0 && strcmp(get_var("c"), "") == 0);
+  set_var("IFS", ":");
+  run("p:q r:s\n", (char *[]){"read", "a", "b", NULL});
+  assert(strcmp(get_var("a"), "p") == 0 && strcmp(get_var("b"), "q r:s") == 0);
+  set_var("IFS", " \t\n");
+  run("a\\ b\\\nc\n", (char *[]){"read", "a", NULL});
+  assert(strcmp(get_var("a"), "a bc") == 0);
+  run("a\\ b\\\nc\n", (char *[]){"read", "-r", "a", NULL});
+  assert(strcmp(get_var("a"), "a\\ b\\") == 0);
+  run("  kept  \n", (char *[]){"read", NULL});
+  assert(strcmp(get_var("REPLY"), "kept") == 0);
+  assert(run("no newline", (char *[]){"read", "a", NULL}) == 1);
+  assert(strcmp(get_var("a"), "no newline") == 0);
+  assert(run("", (char *[]){"read", "a", NULL}) == 1);
+
+  printf("test_builtins: all tests passed\n");
+  return 0;
+}
@@ -0,0 +1,57 @@
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "history.h"
+#include "vars.h"
+
+int main(void) {
+  setenv("HISTFILE", "", 1); /* keep the tests off ~/.ash_history */
+  set_var("HISTSIZE", "5");
+
+  add_to_history("make clean");
+  add_to_history("git status");
+  add_to_history("make -j8 all");
+  add_to_history("ls");
+  add_to_history("git commit -m fix");
+  assert(history_search("make", 5) == 2);
+  assert(history_search("make", 2) == 0);
+  assert(history_search("make", 0) == -1);
+  assert(history_search("git", 5) == 4); /* trigram walk */
+  assert(history_search("s", 5) == 3);   /* too short for a trigram: scanned */
+  assert(history_search("nothing", 5) == -1);
+  assert(history_search("m*8", 5) == 2); /* glob, anywhere in the entry */
+  assert(history_search("g?t s[st]atus", 5) == 1);
+
+  /* the oldest entries fall out of the ring and out of the results */
+  add_to_history("echo one");
+  add_to_history("echo two");
+  assert(strcmp(history_entry(0), "make -j8 all") == 0);
+  assert(history_search("make clean", 5) == -1);
+  assert(history_search("git status", 5) == -1);
+  assert(history_search("echo", 5) == 4);
+  assert(show_history_matches("echo") == 2);
+
+  /* many more entries than slots: the index is rebuilt as entries are evicted */
+  set_var("HISTSIZE", "2000");
+  char buf[64];
+  for (int i = 0; i < 20000; i++) {
+    snprintf(buf, sizeof(buf), "run job-%d --fast", i);
+    add_to_history(buf);
+  }
+  assert(history_search("job-19999 ", 2000) == 1999);
+  assert(history_search("job-18000 ", 2000) == 0);
+  assert(history_search("job-17999 ", 2000) == -1);
+  assert(history_search("job-1850", 2000) == 509);
+  assert(history_search("job-18*0 --", 1000) == 990);
+
+  /* shrinking HISTSIZE keeps the newest entries */
+  set_var("HISTSIZE", "3");
+  add_to_history("last");
+  assert(strcmp(history_entry(0), "run job-19998 --fast") == 0);
+  assert(history_entry(3) == NULL);
+  assert(history_search("job-", 3) == 1);
+
+  printf("test_history: all tests passed\n");
+  return 0;
+}
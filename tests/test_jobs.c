@@ -0,0 +1,45 @@
+#include <assert.h>
+#include <stdio.h>
+#include "jobs.h"
+
+/* Job numbers for a spec, 0 when it names no job */
+static int spec(const char *s) {
+  job_t *job = find_job_spec(s);
+  return job ? job->job_id : 0;
+}
+
+int main(void) {
+  /* no processes are started: the table only needs pids to index */
+  pid_t p1[] = {1001}, p2[] = {1002}, p3[] = {1003, 1004};
+  assert(add_job(1001, p1, 1, "sleep 100", 1) == 1);
+  assert(add_job(1002, p2, 1, "make all", 1) == 2);
+  assert(add_job(1003, p3, 2, "sleep 5 | grep x", 1) == 3);
+
+  /* %n, and the newest job as current (%+ %% %) with the one before as previous (%-) */
+  assert(spec("%1") == 1 && spec("%3") == 3);
+  assert(spec("%4") == 0 && spec("%0") == 0);
+  assert(spec("%+") == 3 && spec("%%") == 3 && spec("%") == 3);
+  assert(spec("%-") == 2);
+
+  /* %string matches the start of the command, %?string any part; it must be unique */
+  assert(spec("%make") == 2);
+  assert(spec("%?grep") == 3);
+  assert(spec("%?all") == 2);
+  assert(spec("%sleep") == 0);   /* jobs 1 and 3 */
+  assert(spec("%?l") == 0);      /* all three */
+  assert(spec("%grep") == 0);    /* not at the start */
+  assert(spec("%nothing") == 0);
+  assert(spec("1") == 0);        /* not a job spec */
+
+  /* fg/bg make a job current; removing it promotes the previous one */
+  set_current_job(find_job(1));
+  assert(spec("%+") == 1 && spec("%-") == 3);
+  remove_job(1);
+  assert(spec("%1") == 0 && spec("%+") == 3 && spec("%-") == 2);
+  assert(spec("%sleep") == 3);   /* no longer ambiguous */
+  assert(find_job_by_pid(1004) == find_job(3));
+  assert(find_job_by_pid(1001) == NULL);
+
+  printf("test_jobs: all tests passed\n");
+  return 0;
+}
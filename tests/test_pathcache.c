@@ -0,0 +1,114 @@
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include "pathcache.h"
+
+static char dir1[] = "/tmp/ash-pathcache-XXXXXX";
+static char dir2[] = "/tmp/ash-pathcache-XXXXXX";
+static char path1[64], path2[64];
+
+/* An executable "tool" script that exits with code */
+static void make_tool(const char *path, int code) {
+  FILE *f = fopen(path, "w");
+  fprintf(f, "#!/bin/sh\nexit %d\n", code);
+  fclose(f);
+  chmod(path, 0755);
+}
+
+/* Does the hash listing show path with this many hits? */
+static int listed(const char *path, unsigned long hits) {
+  FILE *cap = tmpfile();
+  fflush(stdout);
+  int saved = dup(STDOUT_FILENO);
+  dup2(fileno(cap), STDOUT_FILENO);
+  list_command_paths();
+  fflush(stdout);
+  dup2(saved, STDOUT_FILENO);
+  close(saved);
+  char buf[1024], want[128];
+  rewind(cap);
+  size_t n = fread(buf, 1, sizeof(buf) - 1, cap);
+  buf[n] = '\0';
+  fclose(cap);
+  snprintf(want, sizeof(want), "%4lu\t%s\n", hits, path);
+  return strstr(buf, want) != NULL;
+}
+
+/* Exit status of running path through exec_command_path() in a child */
+static int run_tool(const char *path) {
+  pid_t pid = fork();
+  if (pid == 0) {
+    char *args[] = {"tool", NULL};
+    exec_command_path(path, args);
+    _exit(127);
+  }
+  int status;
+  waitpid(pid, &status, 0);
+  return WEXITSTATUS(status);
+}
+
+int main(void) {
+  assert(mkdtemp(dir1) && mkdtemp(dir2));
+  snprintf(path1, sizeof(path1), "%s/tool", dir1);
+  snprintf(path2, sizeof(path2), "%s/tool", dir2);
+  make_tool(path1, 1);
+  make_tool(path2, 2);
+  char path_var[256];
+  snprintf(path_var, sizeof(path_var), "%s:%s:/bin:/usr/bin", dir1, dir2);
+  setenv("PATH", path_var, 1);
+
+  /* hash name remembers a command without counting a hit; running it does */
+  const char *p = hash_command_path("tool");
+  assert(p && strcmp(p, path1) == 0);
+  assert(listed(path1, 0));
+  assert(lookup_command_path("tool") == p);
+  assert(listed(path1, 1));
+  assert(hash_command_path("tool") && listed(path1, 0)); /* hashing again starts over */
+  assert(hash_command_path("no-such-tool") == NULL);
+
+  /* the first directory wins and the answer is remembered */
+  p = lookup_command_path("tool");
+  assert(p && strcmp(p, path1) == 0);
+  assert(lookup_command_path("tool") == p);
+  assert(run_tool(p) == 1);
+  assert(lookup_command_path("no-such-tool") == NULL);
+  assert(strcmp(lookup_command_path("./tool"), "./tool") == 0);
+
+  /* a cached binary that has gone away still runs the next one in PATH */
+  unlink(path1);
+  p = lookup_command_path("tool");
+  assert(strcmp(p, path1) == 0);
+  assert(run_tool(p) == 2);
+
+  /* hash -r forgets it */
+  clear_command_paths();
+  p = lookup_command_path("tool");
+  assert(p && strcmp(p, path2) == 0);
+
+  /* a new PATH drops the table */
+  make_tool(path1, 1);
+  snprintf(path_var, sizeof(path_var), "%s:%s", dir1, dir2);
+  setenv("PATH", path_var, 1);
+  p = lookup_command_path("tool");
+  assert(p && strcmp(p, path1) == 0);
+  setenv("PATH", "/nonexistent", 1);
+  assert(lookup_command_path("tool") == NULL);
+
+  /* hits from a relative PATH entry are not cached */
+  setenv("PATH", ".", 1);
+  assert(chdir(dir2) == 0);
+  assert(strcmp(lookup_command_path("tool"), "./tool") == 0);
+  assert(chdir(dir1) == 0);
+  unlink(path1);
+  assert(lookup_command_path("tool") == NULL);
+
+  unlink(path2);
+  rmdir(dir1);
+  rmdir(dir2);
+  printf("test_pathcache: all tests passed\n");
+  return 0;
+}
@@ -0,0 +1,62 @@
+#include <assert.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/wait.h>
+
+/* Run script with ./ash -c; its stdout is left in out, its exit status returned */
+static char out[4096];
+
+static int sh(const char *script) {
+  char cmd[2048];
+  snprintf(cmd, sizeof(cmd), "./ash -c '%s' 2>/dev/null", script);
+  FILE *p = popen(cmd, "r");
+  assert(p);
+  size_t n = fread(out, 1, sizeof(out) - 1, p);
+  out[n] = '\0';
+  int status = pclose(p);
+  return WIFEXITED(status) ? WEXITSTATUS(status) : -1;
+}
+
+int main(void) {
+  /* PIPESTATUS holds every stage's status; $? is the last one's unless pipefail */
+  sh("false | true | (exit 3); echo ${PIPESTATUS[@]} $?");
+  assert(strcmp(out, "1 0 3 3\n") == 0);
+  sh("false | true; echo ${PIPESTATUS[0]} ${#PIPESTATUS[@]} $?");
+  assert(strcmp(out, "1 2 0\n") == 0);
+  sh("false | true; true; echo ${PIPESTATUS[@]}"); /* a lone command resets it */
+  assert(strcmp(out, "0\n") == 0);
+  sh("false | true; (exit 3); echo ${PIPESTATUS[@]}");
+  assert(strcmp(out, "3\n") == 0);
+  sh("set -o pipefail; (exit 2) | false | true; echo $? ${PIPESTATUS[@]}");
+  assert(strcmp(out, "1 2 1 0\n") == 0);
+  sh("set -o pipefail; true | true; echo $?");
+  assert(strcmp(out, "0\n") == 0);
+  assert(sh("set -o pipefail; false | true") == 1);
+
+  /* lastpipe runs the last stage in the shell, so its assignments survive */
+  sh("set -o lastpipe; echo x | read v; echo \"[$v]\"");
+  assert(strcmp(out, "[x]\n") == 0);
+  sh("echo x | read v; echo \"[$v]\"");
+  assert(strcmp(out, "[]\n") == 0);
+  sh("set -o lastpipe; set +o lastpipe; echo x | read v; echo \"[$v]\"");
+  assert(strcmp(out, "[]\n") == 0);
+  sh("set -o lastpipe; printf \"a\\nb\\n\" | while read l; do n=$l; done; echo \"[$n]\"");
+  assert(strcmp(out, "[b]\n") == 0);
+
+  /* wait -n returns the status of whichever job finishes first, 127 once none are left */
+  sh("sh -c \"sleep 0.3; exit 4\" & sh -c \"sleep 0.05; exit 7\" & "
+     "wait -n; a=$?; wait -n; b=$?; wait -n; echo $a $b $?");
+  assert(strcmp(out, "7 4 127\n") == 0);
+  sh("sh -c \"exit 3\" & wait %1; a=$?; wait; echo $a $?");
+  assert(strcmp(out, "3 0\n") == 0);
+  sh("sleep 5 & kill %1; wait %1; echo $?");
+  assert(strcmp(out, "143\n") == 0);
+  assert(sh("sleep 1 & sleep 1 & kill %sleep") == 1); /* ambiguous */
+
+  /* any other variable is a one-element array */
+  sh("v=\"a b\"; echo \"[${v[0]}] [${v[1]}] [${#v[@]}]\"");
+  assert(strcmp(out, "[a b] [] [1]\n") == 0);
+
+  printf("test_shell: all tests passed\n");
+  return 0;
+}
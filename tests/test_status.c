@@ -0,0 +1,52 @@
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "parser.h"
+#include "shell.h"
+#include "vars.h"
+
+/* Stub commands: "exit N" fails with N, "save X" stores $? in X */
+int parse_and_execute(char *line)
+{
+  if (strncmp(line, "exit ", 5) == 0) return atoi(line + 5);
+  if (strncmp(line, "save ", 5) == 0)
+  {
+    char buf[16];
+    snprintf(buf, sizeof(buf), "%d", last_status);
+    set_var(line + 5, buf);
+    return 0;
+  }
+  return strcmp(line, "false") == 0;
+}
+
+static void run(const char *script)
+{
+  FILE *fp = fmemopen((void *)script, strlen(script), "r");
+  parse_stream(fp);
+  fclose(fp);
+}
+
+static int saved(const char *name) { return atoi(get_var(name)); }
+
+int main(void)
+{
+  /* $? is updated after every command, compound ones included */
+  run("(exit 7); save A\n");
+  assert(saved("A") == 7);
+  run("(exit 7) && save B || save C\n");
+  assert(get_var("B") == NULL && saved("C") == 7);
+  run("false; if false; then :; fi; save D\n");
+  assert(saved("D") == 0);
+  run("{ exit 3; }; save E\n");
+  assert(saved("E") == 3);
+  run("false; while false; do :; done; save F\n");
+  assert(saved("F") == 0);
+  run("case x in y) ;; esac; save G\n");
+  assert(saved("G") == 0);
+  run("if exit 4; then :; else save H; fi\n");
+  assert(saved("H") == 4);
+
+  printf("test_status: all tests passed\n");
+  return 0;
+}
@@ -0,0 +1,61 @@
+#include <assert.h>
+#include <stdio.h>
+#include <string.h>
+#include "testcmd.h"
+#include "vars.h"
+
+static int t(const char *line) {
+  char buf[256];
+  char *args[32];
+  int n = 0;
+  strncpy(buf, line, sizeof(buf) - 1);
+  buf[sizeof(buf) - 1] = '\0';
+  for (char *w = strtok(buf, " "); w; w = strtok(NULL, " ")) args[n++] = w;
+  args[n] = NULL;
+  return strcmp(args[0], "[[") == 0 ? builtin_cond(args, n) : builtin_test(args);
+}
+
+int main(void) {
+  /* POSIX forms by argument count */
+  assert(t("test") == 1);
+  assert(t("test x") == 0);
+  assert(t("[ ! x ]") == 1);
+  assert(t("[ -n x ]") == 0);
+  assert(t("[ a = a ]") == 0);
+  assert(t("[ ( a ) ]") == 0);
+  assert(t("[ ! a = b ]") == 0);
+  assert(t("[ 3 -gt 2 -a 1 -lt 2 -o x = y ]") == 0);
+  assert(t("[ 1 -eq x ]") == 2);
+  assert(t("[ 1 -eq 1") == 2);
+
+  /* file tests */
+  assert(t("[ -d / ]") == 0);
+  assert(t("[ -f / ]") == 1);
+  assert(t("[ -e /nonexistent -o -d / ]") == 0);
+  assert(t("[ / -ef / ]") == 0);
+
+  /* [[ ]]: patterns, regexes and logic */
+  set_var("X", "hello");
+  assert(t("[[ $X == h*o ]]") == 0);
+  assert(t("[[ $X != h*o ]]") == 1);
+  assert(t("[[ $X =~ ^h.l+o$ ]]") == 0);
+  assert(t("[[ a < b && ( 1 -eq 2 || -n $X ) ]]") == 0);
+  assert(t("[[ ! -z $X ]]") == 0);
+  assert(t("[[ a") == 2);
+
+  /* the right side of && / || is not expanded once the left side decides */
+  assert(t("[[ -n $X || -n ${SKIPPED=1} ]]") == 0);
+  assert(get_var("SKIPPED") == NULL);
+  assert(t("[[ -z $X && -n ${SKIPPED=1} ]]") == 1);
+  assert(get_var("SKIPPED") == NULL);
+  set_var("E", "");
+  assert(t("[[ -n $E && $E -gt 5 ]]") == 1);
+  assert(t("[[ -z $E || $E -gt 5 ]]") == 0);
+  assert(t("[[ -n $E && ( $E -gt 5 ) || -z $E ]]") == 0);
+  assert(t("[[ -n $X && -n ${SKIPPED=1} ]]") == 0);
+  assert(strcmp(get_var("SKIPPED"), "1") == 0);
+  assert(t("[[ -z $X && ( a ]]") == 2); /* still parsed */
+
+  printf("test_testcmd: all tests passed\n");
+  return 0;
+}
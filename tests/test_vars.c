@@ -1,8 +1,21 @@
 #include <assert.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
+#include "tokenizer.h"
 #include "vars.h"
 
+/* Command substitution stub: "big" prints 1 MB, anything else echoes itself */
+int parse_and_execute(char *input) {
+  if (strcmp(input, "big") == 0) {
+    for (int i = 0; i < 1024 * 1024; i++) putchar('y');
+    fputs("\n\n", stdout);
+  } else {
+    printf("%s\n\n\n", input);
+  }
+  return 0;
+}
+
 int main(void) {
   /* basic set/get */
   set_var("FOO", "bar");
@@ -15,6 +28,77 @@ int main(void) {
   expand_vars(argv, 2);
   assert(strcmp(argv[1], "bar") == 0);
 
+  /* values are not truncated and the table grows past its initial size */
+  char big[5000];
+  memset(big, 'x', sizeof(big) - 1);
+  big[sizeof(big) - 1] = '\0';
+  set_var("BIG", big);
+  assert(strlen(get_var("BIG")) == sizeof(big) - 1);
+  char name[32];
+  for (int i = 0; i < 1000; i++) {
+    snprintf(name, sizeof(name), "V%d", i);
+    set_var(name, name);
+  }
+  for (int i = 0; i < 1000; i++) {
+    snprintf(name, sizeof(name), "V%d", i);
+    assert(strcmp(get_var(name), name) == 0);
+  }
+  assert(get_var("UNDEFINED") == NULL);
+  assert(strcmp(get_var_n("FOOBAR", 3), "bar") == 0);
+
+  /* command substitution strips every trailing newline and keeps large output whole */
+  char *out = expand_word("$(hello)");
+  assert(strcmp(out, "hello") == 0);
+  free(out);
+  /* the body runs to the matching ')', past quoted and nested ones */
+  out = expand_word("\"$(x \"a)b\" `c)` $(d \")\") 'e)')\"");
+  assert(strcmp(out, "x \"a)b\" `c)` $(d \")\") 'e)'") == 0);
+  free(out);
+  size_t len;
+  out = capture_command_output("big", &len);
+  assert(len == 1024 * 1024 && strlen(out) == len);
+  free(out);
+
+  /* a failed arithmetic expansion is flagged so the command does not run */
+  expansion_failed = 0;
+  out = expand_word("$((1 + 2))");
+  assert(strcmp(out, "3") == 0 && !expansion_failed);
+  free(out);
+  out = expand_word("$((1 / 0))");
+  assert(expansion_failed);
+  free(out);
+  expansion_failed = 0;
+
+  /* "$@" without positional parameters is no field at all */
+  int count;
+  char *at[] = {"\"$@\"", "\"${@}\"", "''\"$@\"", NULL};
+  char **fields = expand_words(at, 2, &count);
+  assert(count == 0);
+  free_tokens(fields);
+  fields = expand_words(at + 2, 1, &count);
+  assert(count == 1 && strcmp(fields[0], "") == 0);
+  free_tokens(fields);
+  set_var("1", "a b");
+  fields = expand_words(at, 1, &count);
+  assert(count == 1 && strcmp(fields[0], "a b") == 0);
+  free_tokens(fields);
+
+  /* word-list subscripts (PIPESTATUS); other variables are one-element arrays */
+  set_var("PIPESTATUS", "0 141 2");
+  set_var("S", "a b");
+  const char *subs[][2] = {{"${PIPESTATUS[0]}", "0"},   {"${PIPESTATUS[1]}", "141"},
+                           {"${PIPESTATUS[3]}", ""},    {"${PIPESTATUS[@]}", "0 141 2"},
+                           {"${#PIPESTATUS[@]}", "3"},  {"${#PIPESTATUS[1]}", "3"},
+                           {"${NOLIST[0]}", ""},        {"${#NOLIST[@]}", "0"},
+                           {"${S[0]}", "a b"},          {"${S[1]}", ""},
+                           {"${S[@]}", "a b"},          {"${#S[@]}", "1"},
+                           {"${#S[0]}", "3"}};
+  for (size_t i = 0; i < sizeof(subs) / sizeof(subs[0]); i++) {
+    out = expand_word(subs[i][0]);
+    assert(strcmp(out, subs[i][1]) == 0);
+    free(out);
+  }
+
   printf("test_vars: all tests passed\n");
   return 0;
 }